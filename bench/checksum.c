@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ml.h>
+#include <pf.h>
+
+// Checks a deterministic build: steps a fixed scene twice, once on one
+// thread and once on four, and compares pf_world_checksum of the runs. Pass
+// a checksum recorded on another machine or build to compare against it too;
+// make deterministic passes the one recorded in the makefile. libml has to be
+// built without -ffast-math and with -ffp-contract=off as well.
+// Usage: checksum [expected hex checksum], or make deterministic CHECKSUM=...
+
+#define STEPS 600
+#define TILES 96
+#define OBJECTS 160
+#define THREADS 4
+#define SEED 2024u
+
+float next_random(unsigned *state, float lo, float hi) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return lo + (hi - lo) * (*state / 4294967296.0f);
+}
+
+PfBody* add_static(PfWorld *w, float px, float py) {
+  PfBody *a = pf_world_add_body(w);
+  a->mode = PF_MODE_STATIC;
+  pf_body_set_mass(0, a);
+  a->pos = _v2f(px, py);
+  a->group = _pf_platform();
+  return a;
+}
+
+// A floor of tiles with a bump every 12, a moving platform above it and
+// balls, pillows and walking characters dropped on both
+bool make_scene(PfWorld *w) {
+  unsigned state = SEED;
+  if (!pf_world_init(w, TILES + OBJECTS + 1) || !pf_world_use_grid(w, 4)) {
+    return false;
+  }
+  for (int i = 0; i < TILES; i++) {
+    PfBody *a = add_static(w, i * 2 + 1, 30);
+    if (i % 12 == 5 || i % 12 == 6) {
+      a->shape.tri = _pf_tri(_v2f(1, 0.5), false, i % 12 == 5 ? PF_CORNER_UR : PF_CORNER_UL);
+      a->shape.tag = PF_SHAPE_TRI;
+      a->pos.y -= 1;
+    } else {
+      a->shape = pf_rect(1, 0.5);
+    }
+  }
+  PfBody *platform = add_static(w, TILES / 2, 20);
+  platform->shape = pf_rect(6, 0.5);
+  for (int i = 0; i < OBJECTS; i++) {
+    PfBody *a = pf_world_add_body(w);
+    a->pos = _v2f(next_random(&state, 1, TILES * 2 - 1), next_random(&state, 2, 18));
+    a->gravity.accel = 60;
+    a->gravity.cap = 0.5;
+    switch (i % 3) {
+    case 0:
+      a->shape = pf_circle(next_random(&state, 0.3, 0.6));
+      pf_bouncy_ball_esque(a);
+      break;
+    case 1:
+      a->shape = pf_rect(next_random(&state, 0.4, 0.8), next_random(&state, 0.3, 0.6));
+      pf_pillow_esque(a);
+      break;
+    default:
+      a->shape = pf_rect(0.5, 0.9);
+      a->group.object.tag = PF_OBJECT_CHARACTER;
+      pf_wood_esque(a);
+      break;
+    }
+  }
+  return pf_world_build_static_tree(w);
+}
+
+// The platform swings left and right, characters turn every two seconds
+void drive_scene(PfWorld *w, int step) {
+  const float force = (step / 120) % 2 ? -5 : 5;
+  w->bodies[TILES].in.impulse = _v2f(force / 2, 0);
+  for (int i = TILES + 1; i < w->body_num; i++) {
+    PfBody *a = &w->bodies[i];
+    if (a->group.object.tag == PF_OBJECT_CHARACTER) {
+      a->in.impulse = addv2f(a->in.impulse, _v2f(force, 0));
+      pf_body_wake(a);
+    }
+  }
+}
+
+bool run_scene(int thread_num, unsigned *checksum) {
+  PfWorld w;
+  if (!make_scene(&w) || (thread_num > 1 && !pf_world_use_threads(&w, thread_num))) {
+    return false;
+  }
+  for (int s = 0; s < STEPS; s++) {
+    drive_scene(&w, s);
+    pf_world_step(&w, w.dt);
+  }
+  *checksum = pf_world_checksum(&w);
+  pf_world_free(&w);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  unsigned single;
+  unsigned threaded;
+  if (!run_scene(1, &single) || !run_scene(THREADS, &threaded)) {
+    return EXIT_FAILURE;
+  }
+  printf("checksum %08x, %d threads %08x\n", single, THREADS, threaded);
+  bool ok = single == threaded;
+  if (argc > 1) {
+    const unsigned expected = strtoul(argv[1], NULL, 16);
+    printf("expected %08x %s\n", expected, single == expected ? "ok" : "WRONG");
+    ok = ok && single == expected;
+  }
+  printf("%s\n", ok ? "deterministic" : "NOT DETERMINISTIC");
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
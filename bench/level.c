@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ml.h>
+#include <pf.h>
+
+// Checks level files: a saved level loads back exactly, and levels whose
+// static tree or shapes were damaged before saving are refused.
+// Usage: level [path of the scratch file]
+
+#define TILES 80
+#define OBJECTS 10
+
+typedef enum {
+  DAMAGE_NONE,
+  DAMAGE_ROOT,
+  DAMAGE_CHILD,
+  DAMAGE_CYCLE,
+  DAMAGE_PARENT,
+  DAMAGE_LEAF_KEY,
+  DAMAGE_LEAF,
+  DAMAGE_SHAPE,
+  DAMAGE_CORNER,
+  DAMAGE_DEEP,
+  DAMAGE_NUM,
+} damage;
+
+const char *damage_names[DAMAGE_NUM] = {
+  "none", "root", "child", "cycle", "parent", "leaf key", "leaf", "shape", "corner", "deep",
+};
+
+bool make_world(PfWorld *w) {
+  if (!pf_world_init(w, TILES + OBJECTS)) {
+    return false;
+  }
+  for (int i = 0; i < TILES; i++) {
+    PfBody *a = pf_world_add_body(w);
+    a->mode = PF_MODE_STATIC;
+    pf_body_set_mass(0, a);
+    a->group = _pf_platform();
+    a->pos = _v2f(i * 2 + 1, 20);
+    if (i % 8 == 3) {
+      a->shape.tri = _pf_tri(_v2f(1, 0.5), false, PF_CORNER_UR);
+      a->shape.tag = PF_SHAPE_TRI;
+    } else {
+      a->shape = pf_rect(1, 0.5);
+    }
+  }
+  for (int i = 0; i < OBJECTS; i++) {
+    PfBody *a = pf_world_add_body(w);
+    a->shape = pf_circle(0.5);
+    a->pos = _v2f(i * 8 + 3, 10);
+    pf_bouncy_ball_esque(a);
+  }
+  return pf_world_build_static_tree(w);
+}
+
+// First branch and first leaf of the static tree
+int find_node(const PfBvh *t, bool leaf) {
+  for (int i = 0; i < t->node_num; i++) {
+    if ((t->nodes[i].key != -1) == leaf) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Rebuilds the static tree as one long chain down the left, so a walk keeps
+// every right leaf pending
+void make_chain(PfBvh *t) {
+  const int n = (t->node_num + 1) / 2;
+  const PfBvhNode root = t->nodes[t->root];
+  PfBvhNode *leaves = malloc(sizeof(PfBvhNode) * n);
+  for (int i = 0, k = 0; i < t->node_num; i++) {
+    if (t->nodes[i].key != -1) {
+      leaves[k++] = t->nodes[i];
+    }
+  }
+  // Branch i is node i, its leaf is node n - 1 + i and the last leaf ends the chain
+  for (int i = 0; i < n - 1; i++) {
+    t->nodes[i] = (PfBvhNode) { .aabb = root.aabb, .left = i + 1, .right = n - 1 + i, .parent = i - 1, .key = -1,
+      .category = root.category, .mask = root.mask };
+  }
+  t->nodes[n - 2].left = 2 * n - 2;
+  for (int i = 0; i < n; i++) {
+    const int node = n - 1 + i;
+    t->nodes[node] = leaves[i];
+    t->nodes[node].parent = i < n - 1 ? i : n - 2;
+    t->nodes[node].left = -1;
+    t->nodes[node].right = -1;
+    t->leaves[leaves[i].key] = node;
+  }
+  t->root = 0;
+  free(leaves);
+}
+
+void apply_damage(PfWorld *w, damage d) {
+  PfBvh *t = &w->statics;
+  const int branch = find_node(t, false);
+  const int leaf = find_node(t, true);
+  switch (d) {
+  case DAMAGE_ROOT:
+    t->root = t->node_num;
+    break;
+  case DAMAGE_CHILD:
+    t->nodes[branch].left = t->node_num + 5;
+    break;
+  case DAMAGE_CYCLE:
+    t->nodes[branch].right = t->root;
+    break;
+  case DAMAGE_PARENT:
+    t->nodes[leaf].parent = -7;
+    break;
+  case DAMAGE_LEAF_KEY:
+    t->nodes[leaf].key = TILES + OBJECTS + 3;
+    break;
+  case DAMAGE_LEAF:
+    t->leaves[t->nodes[leaf].key] = t->node_num;
+    break;
+  case DAMAGE_SHAPE:
+    w->bodies[0].shape.tag = 7;
+    break;
+  case DAMAGE_CORNER:
+    w->bodies[3].shape.tri.hypotenuse = 9;
+    break;
+  case DAMAGE_DEEP:
+    make_chain(t);
+    break;
+  default:
+    break;
+  }
+}
+
+// Whether the level saved after damage d loads, and if so whether exactly
+bool run_case(const char *path, damage d, bool *loaded) {
+  PfWorld saved;
+  PfWorld read;
+  if (!make_world(&saved)) {
+    return false;
+  }
+  const unsigned checksum = pf_world_checksum(&saved);
+  apply_damage(&saved, d);
+  const bool written = pf_world_save_level(&saved, path);
+  pf_world_free(&saved);
+  if (!written || !pf_world_init(&read, TILES + OBJECTS)) {
+    return false;
+  }
+  *loaded = pf_world_copy_level(&read, path);
+  const bool exact = !*loaded || pf_world_checksum(&read) == checksum;
+  pf_world_free(&read);
+  return exact;
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : "level.pflv";
+  int failed = 0;
+  for (damage d = DAMAGE_NONE; d < DAMAGE_NUM; d++) {
+    bool loaded = false;
+    const bool exact = run_case(path, d, &loaded);
+    const bool ok = exact && loaded == (d == DAMAGE_NONE);
+    printf("damage %-9s %-8s %s\n", damage_names[d], loaded ? "loaded" : "refused", ok ? "ok" : "WRONG");
+    failed += !ok;
+  }
+  remove(path);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
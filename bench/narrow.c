@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ml.h>
+#include <pf.h>
+
+// Times pf_body_to_body for every shape pair it dispatches. Each case tests
+// PAIRS seeded random placements, about half of them touching, ROUNDS times.
+
+#define PAIRS 4096
+#define ROUNDS 500
+#define SEED 12345u
+
+typedef enum {
+  SHAPE_RECT,
+  SHAPE_CIRCLE,
+  SHAPE_TRI,
+  SHAPE_TRI_LINE,
+} shape_kind;
+
+typedef struct {
+  const char *name;
+  shape_kind a;
+  shape_kind b;
+  PfCorner corner;
+} narrow_case;
+
+const narrow_case cases[] = {
+  { "rect-rect",        SHAPE_RECT,   SHAPE_RECT,     PF_CORNER_UL },
+  { "rect-circle",      SHAPE_RECT,   SHAPE_CIRCLE,   PF_CORNER_UL },
+  { "circle-circle",    SHAPE_CIRCLE, SHAPE_CIRCLE,   PF_CORNER_UL },
+  { "rect-tri ul",      SHAPE_RECT,   SHAPE_TRI,      PF_CORNER_UL },
+  { "rect-tri ur",      SHAPE_RECT,   SHAPE_TRI,      PF_CORNER_UR },
+  { "rect-tri dl",      SHAPE_RECT,   SHAPE_TRI,      PF_CORNER_DL },
+  { "rect-tri dr",      SHAPE_RECT,   SHAPE_TRI,      PF_CORNER_DR },
+  { "rect-tri ul line", SHAPE_RECT,   SHAPE_TRI_LINE, PF_CORNER_UL },
+  { "rect-tri ur line", SHAPE_RECT,   SHAPE_TRI_LINE, PF_CORNER_UR },
+  { "rect-tri dl line", SHAPE_RECT,   SHAPE_TRI_LINE, PF_CORNER_DL },
+  { "rect-tri dr line", SHAPE_RECT,   SHAPE_TRI_LINE, PF_CORNER_DR },
+  { "circle-tri ul",    SHAPE_CIRCLE, SHAPE_TRI,      PF_CORNER_UL },
+  { "circle-tri ur",    SHAPE_CIRCLE, SHAPE_TRI,      PF_CORNER_UR },
+  { "circle-tri dl",    SHAPE_CIRCLE, SHAPE_TRI,      PF_CORNER_DL },
+  { "circle-tri dr",    SHAPE_CIRCLE, SHAPE_TRI,      PF_CORNER_DR },
+};
+
+PfBody as[PAIRS];
+PfBody bs[PAIRS];
+
+double now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// xorshift32, so runs on every libc test the same inputs
+float next_random(unsigned *state, float lo, float hi) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return lo + (hi - lo) * (*state / 4294967296.0f);
+}
+
+PfShape random_shape(unsigned *state, shape_kind kind, PfCorner corner) {
+  const float w = next_random(state, 0.3, 1.5);
+  const float h = next_random(state, 0.3, 1.5);
+  PfShape shape;
+  switch (kind) {
+  case SHAPE_RECT:
+    return pf_rect(w, h);
+  case SHAPE_CIRCLE:
+    return pf_circle(w);
+  case SHAPE_TRI:
+  case SHAPE_TRI_LINE:
+    shape.tag = PF_SHAPE_TRI;
+    shape.tri = _pf_tri(_v2f(w, h), kind == SHAPE_TRI_LINE, corner);
+    return shape;
+  default:
+    return pf_circle(w);
+  }
+}
+
+void make_pairs(const narrow_case *c, unsigned *state) {
+  for (int i = 0; i < PAIRS; i++) {
+    as[i] = _pf_body();
+    bs[i] = _pf_body();
+    as[i].shape = random_shape(state, c->a, c->corner);
+    bs[i].shape = random_shape(state, c->b, c->corner);
+    as[i].pos = _v2f(next_random(state, -2.5, 2.5), next_random(state, -2.5, 2.5));
+  }
+}
+
+int main() {
+  unsigned state = SEED;
+  printf("%-18s %10s %12s %6s\n", "pair", "ns/call", "calls/sec", "hit%");
+  for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+    const narrow_case *c = &cases[k];
+    make_pairs(c, &state);
+    int hits = 0;
+    v2f normal;
+    float penetration;
+    for (int i = 0; i < PAIRS; i++) {
+      hits += pf_body_to_body(&as[i], &bs[i], &normal, &penetration);
+    }
+
+    volatile float sink = 0;
+    const double start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+      for (int i = 0; i < PAIRS; i++) {
+        if (pf_body_to_body(&as[i], &bs[i], &normal, &penetration)) {
+          sink += penetration;
+        }
+      }
+    }
+    const double ns = (now_ns() - start) / ((double)ROUNDS * PAIRS);
+    printf("%-18s %10.2f %12.0f %6.1f\n", c->name, ns, 1e9 / ns, 100.0 * hits / PAIRS);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ml.h>
+#include <pf.h>
+
+// Checks one-way platforms: bodies falling onto one straight or diagonally
+// land on top as they do on a solid one, and bodies jumping up through it
+// from below land on top too.
+
+#define STEPS 300
+#define PUSH_STEPS 30
+#define PLATFORM_Y 10
+#define FLOOR_Y 20
+
+typedef struct {
+  const char *name;
+  bool one_way;
+  bool circle;
+  v2f from;
+  v2f push;         // in impulse kept up for PUSH_STEPS
+} oneway_case;
+
+const oneway_case cases[] = {
+  { "fall box",               true,  false, { 0, 2 },   { 0, 0 } },
+  { "fall box diagonal",      true,  false, { -4, 2 },  { 5, 0 } },
+  { "fall box diagonal fast", true,  false, { 4, 2 },   { -20, 0 } },
+  { "fall ball diagonal",     true,  true,  { -4, 2 },  { 5, 0 } },
+  { "fall box diagonal solid",false, false, { -4, 2 },  { 5, 0 } },
+  { "jump box",               true,  false, { 0, 19 },  { 0, -60 } },
+  { "jump box diagonal",      true,  false, { -4, 19 }, { 5, -60 } },
+  { "jump ball diagonal",     true,  true,  { 4, 19 },  { -5, -60 } },
+};
+
+PfBody* add_rect(PfWorld *w, float rw, float rh, float px, float py) {
+  PfBody *a = pf_world_add_body(w);
+  a->mode = PF_MODE_STATIC;
+  a->group = _pf_platform();
+  a->shape = pf_rect(rw, rh);
+  a->pos = _v2f(px, py);
+  pf_static_esque(a);
+  return a;
+}
+
+bool run_case(const oneway_case *c, float *y) {
+  PfWorld w;
+  if (!pf_world_init(&w, 3)) {
+    return false;
+  }
+  PfBody *platform = add_rect(&w, 12, 1, 0, PLATFORM_Y);
+  if (c->one_way) {
+    platform->group.platform.allow = PF_DIR_U | PF_DIR_L | PF_DIR_R;
+  }
+  (void)add_rect(&w, 20, 0.5, 0, FLOOR_Y);
+  PfBody *a = pf_world_add_body(&w);
+  a->shape = c->circle ? pf_circle(0.5) : pf_rect(0.5, 0.5);
+  a->pos = c->from;
+  a->gravity.accel = 60;
+  a->gravity.cap = 0.5;
+  pf_wood_esque(a);
+  if (!pf_world_build_static_tree(&w)) {
+    pf_world_free(&w);
+    return false;
+  }
+  for (int s = 0; s < STEPS; s++) {
+    if (s < PUSH_STEPS) {
+      w.bodies[2].in.impulse = c->push;
+    }
+    pf_world_step(&w, w.dt);
+  }
+  *y = w.bodies[2].pos.y;
+  pf_world_free(&w);
+  return true;
+}
+
+int main() {
+  const float top = PLATFORM_Y - 1 - 0.5;
+  int failed = 0;
+  for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+    const oneway_case *c = &cases[k];
+    float y;
+    if (!run_case(c, &y)) {
+      return EXIT_FAILURE;
+    }
+    const bool ok = fabsf(y - top) < 0.1;
+    printf("%-24s y %6.2f %s\n", c->name, y, ok ? "ok" : "WRONG");
+    failed += !ok;
+  }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ml.h>
+#include <pf.h>
+
+// Replicates a busy 500 body world to a mirror through encoded frames.
+// Frames are deltas against the state of ACK ticks ago, as if the client
+// had acknowledged it, and are compared with frames against nothing.
+
+#define TILES 100
+#define BODIES 400
+#define TICKS 600
+#define ACK 6
+#define FRAME_CAP (1 << 16)
+
+double now_us() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+// Key of the body a stands on, -1 if none
+int parent_key(const PfWorld *w, const PfBody *a) {
+  const PfBody *parent = pf_world_get(w, a->group.object.parent);
+  return a->mode == PF_MODE_DYNAMIC && parent ? (int)(parent - w->bodies) : -1;
+}
+
+bool make_world(PfWorld *w) {
+  if (!pf_world_init(w, TILES + BODIES)) {
+    return false;
+  }
+  for (int i = 0; i < TILES; i++) {
+    PfBody *a = pf_world_add_body(w);
+    a->mode = PF_MODE_STATIC;
+    a->group = _pf_platform();
+    a->shape = pf_rect(1, 0.5);
+    a->pos = _v2f(i * 2 + 1, 40);
+    pf_static_esque(a);
+  }
+  for (int i = 0; i < BODIES; i++) {
+    PfBody *a = pf_world_add_body(w);
+    a->shape = i % 2 ? pf_rect(0.6, 0.8) : pf_circle(0.5);
+    a->pos = _v2f((i % TILES) * 2 + 1, 36 - (i / TILES) * 2);
+    pf_wood_esque(a);
+  }
+  return pf_world_build_static_tree(w);
+}
+
+int main() {
+  static PfWorld server;
+  static PfWorld client;
+  static PfSnapshot server_base[ACK];
+  static PfSnapshot client_base[ACK];
+  static unsigned char frame[FRAME_CAP];
+  if (!make_world(&server) || !make_world(&client)) {
+    return EXIT_FAILURE;
+  }
+  for (int i = 0; i < ACK; i++) {
+    if (!pf_snapshot_init(&server_base[i], server.body_cap) ||
+        !pf_snapshot_init(&client_base[i], client.body_cap)) {
+      return EXIT_FAILURE;
+    }
+  }
+  double delta_bytes = 0;
+  double full_bytes = 0;
+  double encode_us = 0;
+  double decode_us = 0;
+  float error = 0;
+  int attached = 0;
+  int parent_errors = 0;
+  for (int t = 0; t < TICKS; t++) {
+    // Keep a few bodies jumping so there is always something to send
+    PfBody *kick = &server.bodies[TILES + (t * 7) % BODIES];
+    kick->in.impulse = _v2f(t % 2 ? 20 : -20, -30);
+    pf_world_step(&server, server.dt);
+
+    const int slot = t % ACK;
+    const PfSnapshot *sb = t >= ACK ? &server_base[slot] : NULL;
+    const PfSnapshot *cb = t >= ACK ? &client_base[slot] : NULL;
+    double start = now_us();
+    const size_t size = pf_world_encode(&server, sb, frame, FRAME_CAP);
+    encode_us += now_us() - start;
+    start = now_us();
+    if (!size || !pf_world_decode(&client, cb, frame, size)) {
+      puts("frame lost");
+      return EXIT_FAILURE;
+    }
+    decode_us += now_us() - start;
+    delta_bytes += size;
+    full_bytes += pf_world_encode(&server, NULL, frame, FRAME_CAP);
+    pf_world_snapshot(&server, &server_base[slot]);
+    pf_world_snapshot(&client, &client_base[slot]);
+    for (int i = 0; i < server.body_num; i++) {
+      const v2f d = subv2f(server.bodies[i].pos, client.bodies[i].pos);
+      error = fmaxf(error, fmaxf(fabsf(d.x), fabsf(d.y)));
+      const int parent = parent_key(&server, &server.bodies[i]);
+      attached += parent != -1;
+      parent_errors += parent != parent_key(&client, &client.bodies[i]);
+    }
+  }
+  printf("bodies %d ticks %d\n", server.body_num, TICKS);
+  printf("delta frame %.0f bytes/tick\n", delta_bytes / TICKS);
+  printf("full frame  %.0f bytes/tick\n", full_bytes / TICKS);
+  printf("encode %.2f us decode %.2f us\n", encode_us / TICKS, decode_us / TICKS);
+  printf("max position error %g\n", error);
+  printf("parents %.0f attached/tick, %d wrong\n", (double)attached / TICKS, parent_errors);
+  for (int i = 0; i < ACK; i++) {
+    pf_snapshot_free(&server_base[i]);
+    pf_snapshot_free(&client_base[i]);
+  }
+  pf_world_free(&server);
+  pf_world_free(&client);
+  return parent_errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ml.h>
+#include <pf.h>
+
+// Times pf_world_snapshot and pf_world_restore on a settled 500 body world.
+// Gravity doesn't go through the solver, so the bodies are kept pressing on
+// the tiles without bouncing to keep their contacts in the cache.
+
+#define TILES 100
+#define BODIES 400
+#define ROUNDS 10000
+#define SETTLE_STEPS 120
+
+double now_us() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+bool make_world(PfWorld *w) {
+  for (int i = 0; i < TILES; i++) {
+    PfBody *a = pf_world_add_body(w);
+    a->mode = PF_MODE_STATIC;
+    a->group = _pf_platform();
+    a->shape = pf_rect(1, 0.5);
+    a->pos = _v2f(i * 2 + 1, 40);
+    pf_static_esque(a);
+  }
+  for (int i = 0; i < BODIES; i++) {
+    PfBody *a = pf_world_add_body(w);
+    a->shape = i % 2 ? pf_rect(0.6, 0.8) : pf_circle(0.5);
+    a->pos = _v2f((i % TILES) * 2 + 1, 36 - (i / TILES) * 2);
+    pf_body_esque(0.3, 0, a);
+  }
+  return pf_world_build_static_tree(w);
+}
+
+void press(PfWorld *w) {
+  for (int i = TILES; i < w->body_num; i++) {
+    PfBody *a = &w->bodies[i];
+    a->ex.impulse = addv2f(a->ex.impulse, _v2f(0, 0.5));
+  }
+}
+
+int main() {
+  PfWorld w;
+  PfSnapshot s;
+  if (!pf_world_init(&w, TILES + BODIES) || !pf_snapshot_init(&s, w.body_cap) || !make_world(&w)) {
+    return EXIT_FAILURE;
+  }
+  for (int i = 0; i < SETTLE_STEPS; i++) {
+    press(&w);
+    pf_world_step(&w, w.dt);
+  }
+  pf_world_snapshot(&w, &s);
+  const unsigned checksum = pf_world_checksum(&w);
+
+  double start = now_us();
+  for (int i = 0; i < ROUNDS; i++) {
+    pf_world_snapshot(&w, &s);
+  }
+  const double snapshot_us = (now_us() - start) / ROUNDS;
+
+  start = now_us();
+  for (int i = 0; i < ROUNDS; i++) {
+    pf_world_restore(&w, &s);
+  }
+  const double restore_us = (now_us() - start) / ROUNDS;
+
+  printf("bodies %d\n", w.body_num);
+  printf("snapshot %.2f us, %d cached contacts\n", snapshot_us, s.cache_num);
+  printf("restore  %.2f us, %d cached contacts\n", restore_us, w.cache_num);
+  const bool exact = pf_world_checksum(&w) == checksum;
+  printf("restored %s\n", exact ? "exactly" : "WRONG");
+  pf_snapshot_free(&s);
+  pf_world_free(&w);
+  return exact ? EXIT_SUCCESS : EXIT_FAILURE;
+}
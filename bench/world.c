@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ml.h>
+#include <pf.h>
+
+// Steps generated levels of 64 to 16k bodies, half level geometry and half
+// balls, pillows and walking characters, and times each phase of the step
+// with the phase times a PF_STATS build keeps.
+// Usage: world [frames]
+
+#define MIN_BODIES 64
+#define MAX_BODIES (16 * 1024)
+#define FRAMES 300
+#define ROW_TILES 64
+#define SEED 12345u
+
+#ifndef PF_STATS
+#error "world reads the phase times of PfStats, build it and pf with -DPF_STATS"
+#endif
+
+const char *phase_names[PF_PHASE_NUM] = {
+  "relations", "platforms", "contacts", "solve", "correct",
+};
+
+double now_us() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+float next_random(unsigned *state, float lo, float hi) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return lo + (hi - lo) * (*state / 4294967296.0f);
+}
+
+PfBody* world_add_tri(PfWorld *w, float rw, float rh, float px, float py, PfCorner hypotenuse, bool line) {
+  PfBody *a = pf_world_add_body(w);
+  a->mode = PF_MODE_STATIC;
+  pf_body_set_mass(0, a);
+  a->shape.tri = _pf_tri(_v2f(rw,rh), line, hypotenuse);
+  a->shape.tag = PF_SHAPE_TRI;
+  a->pos = _v2f(px, py);
+  a->group = _pf_platform();
+  return a;
+}
+
+PfBody* world_add_rect(PfWorld *w, float rw, float rh, float px, float py) {
+  PfBody *a = pf_world_add_body(w);
+  a->mode = PF_MODE_STATIC;
+  pf_body_set_mass(0, a);
+  a->shape = pf_rect(rw, rh);
+  a->pos = _v2f(px, py);
+  a->group = _pf_platform();
+  return a;
+}
+
+// Rows of ROW_TILES tiles 8 apart, a bump of two slopes every 16 tiles
+void make_level(PfWorld *w, int tile_num) {
+  for (int i = 0; i < tile_num; i++) {
+    const float x = (i % ROW_TILES) * 2 + 1;
+    const float y = (i / ROW_TILES) * 8 + 8;
+    switch (i % 16) {
+    case 7:
+      (void)world_add_tri(w, 1, 0.5, x, y - 1, PF_CORNER_UR, false);
+      break;
+    case 8:
+      (void)world_add_tri(w, 1, 0.5, x, y - 1, PF_CORNER_UL, false);
+      break;
+    default:
+      (void)world_add_rect(w, 1, 0.5, x, y);
+      break;
+    }
+  }
+}
+
+void make_objects(PfWorld *w, int tile_num, int object_num, unsigned *state) {
+  const int row_num = (tile_num + ROW_TILES - 1) / ROW_TILES;
+  for (int i = 0; i < object_num; i++) {
+    PfBody *a = pf_world_add_body(w);
+    const int row = i % row_num;
+    a->pos = _v2f(next_random(state, 1, ROW_TILES * 2 - 1), row * 8 + next_random(state, 1, 5));
+    switch (i % 3) {
+    case 0:
+      a->shape = pf_circle(next_random(state, 0.3, 0.6));
+      pf_bouncy_ball_esque(a);
+      break;
+    case 1:
+      a->shape = pf_rect(next_random(state, 0.4, 0.8), next_random(state, 0.3, 0.6));
+      pf_pillow_esque(a);
+      break;
+    default:
+      a->shape = pf_rect(0.5, 0.9);
+      a->group.object.tag = PF_OBJECT_CHARACTER;
+      pf_wood_esque(a);
+      break;
+    }
+  }
+}
+
+bool make_world(PfWorld *w, int body_num) {
+  unsigned state = SEED;
+  if (!pf_world_init(w, body_num) || !pf_world_use_grid(w, 4)) {
+    return false;
+  }
+  make_level(w, body_num / 2);
+  make_objects(w, body_num / 2, body_num - body_num / 2, &state);
+  return pf_world_build_static_tree(w);
+}
+
+// Characters walk, turning every two seconds
+void walk_characters(PfWorld *w, int frame) {
+  const float force = (frame / 120) % 2 ? -5 : 5;
+  for (int i = 0; i < w->body_num; i++) {
+    PfBody *a = &w->bodies[i];
+    if (a->mode == PF_MODE_DYNAMIC && a->group.object.tag == PF_OBJECT_CHARACTER) {
+      a->in.impulse = addv2f(a->in.impulse, _v2f(force, 0));
+      pf_body_wake(a);
+    }
+  }
+}
+
+int compare_us(const void *x, const void *y) {
+  const double a = *(const double*)x;
+  const double b = *(const double*)y;
+  return (a > b) - (a < b);
+}
+
+int main(int argc, char **argv) {
+  const int frames = argc > 1 ? atoi(argv[1]) : FRAMES;
+  double *frame_us = frames > 0 ? malloc(sizeof(double) * frames) : NULL;
+  if (!frame_us) {
+    return EXIT_FAILURE;
+  }
+  printf("%6s", "bodies");
+  for (int p = 0; p < PF_PHASE_NUM; p++) {
+    printf(" %10s", phase_names[p]);
+  }
+  printf(" %9s %9s %9s  (us per frame)\n", "mean", "p50", "p99");
+  for (int n = MIN_BODIES; n <= MAX_BODIES; n *= 2) {
+    PfWorld w;
+    if (!make_world(&w, n)) {
+      return EXIT_FAILURE;
+    }
+    pf_world_reset_stats(&w);
+    double total_us = 0;
+    for (int f = 0; f < frames; f++) {
+      walk_characters(&w, f);
+      const double start = now_us();
+      pf_world_step(&w, w.dt);
+      frame_us[f] = now_us() - start;
+      total_us += frame_us[f];
+    }
+    if (w.stats.steps != frames) {
+      puts("pf was built without PF_STATS");
+      return EXIT_FAILURE;
+    }
+    qsort(frame_us, frames, sizeof(double), compare_us);
+    printf("%6d", n);
+    for (int p = 0; p < PF_PHASE_NUM; p++) {
+      printf(" %10.1f", w.stats.phase_us[p] / frames);
+    }
+    printf(" %9.1f %9.1f %9.1f\n", total_us / frames, frame_us[frames / 2], frame_us[frames * 99 / 100]);
+    pf_world_free(&w);
+  }
+  free(frame_us);
+  return EXIT_SUCCESS;
+}
@@ -6,12 +6,12 @@
 #include <SDL2/SDL.h>
 #include <math.h>
 
-#define IGNORE_MP\
-  const int MOVING_PLATFORM = 3;\
-  if ((km->a_key == MOVING_PLATFORM && km->manifold.normal.y >= 0) ||\
-    (km->b_key == MOVING_PLATFORM && km->manifold.normal.y <= 0)) {\
-    continue;\
-  }
+// Collision layers, see PfBody.category and PfBody.mask
+enum {
+  LAYER_DEFAULT = 1,
+  LAYER_ITEM = 2,
+  LAYER_LEVEL = 4,
+};
 
 typedef int PolyRef;
 typedef int FaceRef;
@@ -27,26 +27,9 @@ typedef struct {
   const PfBody *body;
 } key_body;
 
-typedef struct {
-  int a_key;
-  int b_key;
-  PfManifold manifold;
-} keys_manifold;
-
 #define MAX_BODIES 4096 /* So many bodies */
-#define MAX_MANIFOLDS (MAX_BODIES * 2) /* Large enough */
 #define CANNON_BALL_RADIUS 1.5
 
-typedef struct {
-  PfBody bodies[MAX_BODIES];
-  int body_num;
-  keys_manifold manifolds[MAX_MANIFOLDS];
-  int manifold_num;
-  float dt;
-  int iterations;
-  bool platform_dir;
-} world;
-
 typedef struct {
   bool quit;
   bool left;
@@ -58,7 +41,8 @@ typedef struct {
 
 typedef struct {
   SDL_Renderer *renderer;
-  world world;
+  PfWorld world;
+  bool platform_dir;
   input input;
 } demo;
 
@@ -101,52 +85,60 @@ int main() {
   demo demo;
   puts("make_demo");
   make_demo(&demo, renderer);
+#ifdef PF_TRACE
+  // Room for ten seconds of steps, less when many islands are awake
+  pf_world_trace(&demo.world, 1 << 15);
+#endif
   puts("loop_demo");
   loop_demo(&demo);
   puts("end_demo");
+#ifdef PF_TRACE
+  pf_world_dump_trace(&demo.world, "trace.json");
+#endif
+  pf_world_free(&demo.world);
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(win);
   SDL_Quit();
   return EXIT_SUCCESS;
 }
 
-PfBody* world_add_tri(world *w, float rw, float rh, float px, float py, PfCorner hypotenuse, bool line) {
-  PfBody *a = &w->bodies[w->body_num];
-  w->body_num++;
-  *a = _pf_body();
+PfBody* world_add_tri(PfWorld *w, float rw, float rh, float px, float py, PfCorner hypotenuse, bool line) {
+  PfBody *a = pf_world_add_body(w);
   a->mode = PF_MODE_STATIC;
   pf_body_set_mass(0, a);
   a->shape.tri = _pf_tri(_v2f(rw,rh), line, hypotenuse);
   a->shape.tag = PF_SHAPE_TRI;
   a->pos = _v2f(px, py);
   a->group = _pf_platform();
+  a->category = LAYER_DEFAULT | LAYER_LEVEL;
   return a;
 }
 
-PfBody* world_add_rect(world *w, float rw, float rh, float px, float py) {
-  PfBody *a = &w->bodies[w->body_num];
-  w->body_num++;
-  *a = _pf_body();
+PfBody* world_add_rect(PfWorld *w, float rw, float rh, float px, float py) {
+  PfBody *a = pf_world_add_body(w);
   a->mode = PF_MODE_STATIC;
   pf_body_set_mass(0, a);
   a->shape = pf_rect(rw, rh);
   a->pos = _v2f(px, py);
   a->group = _pf_platform();
+  a->category = LAYER_DEFAULT | LAYER_LEVEL;
   return a;
 }
 
-void make_world(world *w) {
-  w->body_num = 0;
-  w->manifold_num = 0;
+void move_platforms(void *arg);
+
+void make_world(PfWorld *w) {
+  pf_world_init(w, MAX_BODIES);
+  pf_world_use_grid(w, 4);
   w->dt = 1.0 / 60.0;
   w->iterations = 1;
-  w->platform_dir = true; 
+  // Script platform movement
+  w->before_step = move_platforms;
+  w->step_arg = w;
 
   // Large circle
   {
-    PfBody *a = &w->bodies[w->body_num];
-    w->body_num++;
-    *a = _pf_body();
+    PfBody *a = pf_world_add_body(w);
     a->gravity.accel = 60;
     a->gravity.cap = 0.5;
     a->shape = pf_circle(1.2);
@@ -156,21 +148,22 @@ void make_world(world *w) {
 
   // Small circle
   {
-    PfBody *a = &w->bodies[w->body_num];
-    w->body_num++;
-    *a = _pf_body();
+    PfBody *a = pf_world_add_body(w);
     a->gravity.accel = 60;
     a->gravity.cap = 0.5;
     a->shape = pf_circle(1);
     a->pos = _v2f(28,2);
+    a->group.object.tag = PF_OBJECT_ITEM;
+    // Items only meet the level, they pass through each other and
+    // neither push nor get pushed by other bodies
+    a->category = LAYER_ITEM;
+    a->mask = LAYER_LEVEL;
     pf_super_ball_esque(a);
   }
 
   // Rectangle
   {
-    PfBody *a = &w->bodies[w->body_num];
-    w->body_num++;
-    *a = _pf_body();
+    PfBody *a = pf_world_add_body(w);
     a->gravity.accel =1; 
     a->gravity.cap = 0.5;
     a->shape = pf_rect(2,1);
@@ -178,9 +171,10 @@ void make_world(world *w) {
     pf_pillow_esque(a);
   }
 
-  // Platform
+  // Platform, jumped up onto from below or the sides
   {
-    (void)world_add_rect(w, 24.6, 1.2, 32, 38.4);
+    PfBody *a = world_add_rect(w, 24.6, 1.2, 32, 38.4);
+    a->group.platform.allow = PF_DIR_U | PF_DIR_L | PF_DIR_R;
   }
 
   /*
@@ -311,10 +305,10 @@ void make_world(world *w) {
     a[3] = world_add_rect(w, 2.95, 2.8, x + 11, y + 0.8);
     a[4] = world_add_tri(w, 2.95, 0.8,  x + 11, y - 2.8, PF_CORNER_UR, false);
 
-    a[0]->group.platform.right = a[2];
-    a[2]->group.platform.left = a[0];
-    a[2]->group.platform.right = a[4];
-    a[4]->group.platform.left = a[2];
+    a[0]->group.platform.right = a[2]->handle;
+    a[2]->group.platform.left = a[0]->handle;
+    a[2]->group.platform.right = a[4]->handle;
+    a[4]->group.platform.left = a[2]->handle;
   }
   // Top Platform
   {
@@ -330,14 +324,14 @@ void make_world(world *w) {
     a[2] = world_add_tri(w, 2.8 * sx, 0.25,  x + sx * (8.2 + 2.8), y - 0.25, PF_CORNER_UL, true);
     a[3] = world_add_tri(w, 2.4 * sx, 1.2,  x + sx * (8.2 + 2.8 * 2 + 2.4), y - 0.25 * 2 + 1.2, PF_CORNER_UR, true); // 0.9 is adjusted from 1.2
     a[4] = world_add_rect(w, 2.0 * sx, h, x + sx * (8.2 + 2.8 * 2 + 2.4 * 2 + 2.0), y - 0.25 * 2 + 1.2 * 2);
-    a[0]->group.platform.right = a[1];
+    a[0]->group.platform.right = a[1]->handle;
 
     for (int i = 1; i < 4; i++) {
-      a[i]->group.platform.left = a[i - 1];
-      a[i]->group.platform.right = a[i + 1];
+      a[i]->group.platform.left = a[i - 1]->handle;
+      a[i]->group.platform.right = a[i + 1]->handle;
     }
     
-    a[4]->group.platform.left = a[3];
+    a[4]->group.platform.left = a[3]->handle;
   }
   // tri guards
   {
@@ -353,10 +347,13 @@ void make_world(world *w) {
     w->bodies[i].gravity.dir = PF_DIR_D;
   }
 
+  pf_world_build_static_tree(w);
+
 }
 
 void make_demo(demo *d, SDL_Renderer *renderer) {
   d->renderer = renderer;
+  d->platform_dir = true;
   make_world(&d->world);
 }
 
@@ -392,12 +389,12 @@ unsigned int delay_time(unsigned int goal, unsigned int start, unsigned int end)
   return frame >= goal ? 0 : (goal - frame);
 }
 
-void step_world(world *w);
+void step_world(PfWorld *w, float elapsed);
 void render_demo(demo *d);
 
-void transform_move_on_flat(PfBody *a, float dt_) {
+void transform_move_on_flat(const PfWorld *w, PfBody *a, float dt_) {
   const float dt = 2 * dt_; // Adjust for round off
-  const PfBody *b = a->group.object.parent;
+  const PfBody *b = pf_world_get(w, a->group.object.parent);
   if (!b ||
     b->shape.tag != PF_SHAPE_RECT ||
     a->shape.tag != PF_SHAPE_RECT ||
@@ -434,10 +431,10 @@ void transform_move_on_flat(PfBody *a, float dt_) {
         weight = 0;
       }
       // Move onto next platform
-      if (a->group.object.parent->group.platform.left) {
-        a->group.object.parent = a->group.object.parent->group.platform.left;
-        const PfBody *c = a->group.object.parent;
-        if (c->shape.tag == PF_SHAPE_TRI) {
+      if (!pf_handle_none(b->group.platform.left)) {
+        a->group.object.parent = b->group.platform.left;
+        const PfBody *c = pf_world_get(w, a->group.object.parent);
+        if (c && c->shape.tag == PF_SHAPE_TRI) {
           next = mulv2nf(pf_move_left_on_slope_transform(&c->shape.tri), force);
         }
       } else {
@@ -460,10 +457,10 @@ void transform_move_on_flat(PfBody *a, float dt_) {
         weight = 0;
       }
       // Move onto next flat
-      if (a->group.object.parent->group.platform.right) {
-        a->group.object.parent = a->group.object.parent->group.platform.right;
-        const PfBody *c = a->group.object.parent;
-        if (c->shape.tag == PF_SHAPE_TRI) {
+      if (!pf_handle_none(b->group.platform.right)) {
+        a->group.object.parent = b->group.platform.right;
+        const PfBody *c = pf_world_get(w, a->group.object.parent);
+        if (c && c->shape.tag == PF_SHAPE_TRI) {
           next = mulv2nf(pf_move_right_on_slope_transform(&c->shape.tri), force);
         }
       } else {
@@ -475,14 +472,15 @@ void transform_move_on_flat(PfBody *a, float dt_) {
   }
 }
 
-void transform_move_on_platform(PfBody *ch, float dt) {
-  if (ch->group.object.parent) {
-    switch (ch->group.object.parent->shape.tag) {
+void transform_move_on_platform(const PfWorld *w, PfBody *ch, float dt) {
+  const PfBody *parent = pf_world_get(w, ch->group.object.parent);
+  if (parent) {
+    switch (parent->shape.tag) {
     case PF_SHAPE_RECT:
-      transform_move_on_flat(ch, dt);
+      transform_move_on_flat(w, ch, dt);
       break;
     case PF_SHAPE_TRI:
-      pf_transform_move_on_slope(ch, dt);
+      pf_transform_move_on_slope(w, ch, dt);
       break;
     default:
       break;
@@ -492,8 +490,11 @@ void transform_move_on_platform(PfBody *ch, float dt) {
 
 void loop_demo(demo *d) {
   d->input.quit = false;
+  unsigned int last_tick = SDL_GetTicks();
   do {
     const unsigned int start_tick = SDL_GetTicks();
+    const float elapsed = (start_tick - last_tick) / 1000.0f;
+    last_tick = start_tick;
     read_input(&d->input);
     //
     PfBody *ch = &d->world.bodies[2];
@@ -510,14 +511,14 @@ void loop_demo(demo *d) {
       add = addv2f(add, _v2f(0, -force));
       ch->group.object.check_parent = true;
     }
-    if (d->input.down && !ch->group.object.parent) {
+    if (d->input.down && pf_handle_none(ch->group.object.parent)) {
       add = addv2f(add, _v2f(0, force));
       ch->group.object.check_parent = true;
     }
     ch->in.impulse = addv2f(ch->in.impulse, add);
-    transform_move_on_platform(ch, d->world.dt);
+    transform_move_on_platform(&d->world, ch, d->world.dt);
     if (d->input.change_axis) {
-      d->world.platform_dir = !d->world.platform_dir;
+      d->platform_dir = !d->platform_dir;
     }
     //
     {
@@ -529,15 +530,15 @@ void loop_demo(demo *d) {
       }
     }
     //
-    step_world(&d->world);
+    step_world(&d->world, elapsed);
 
   /*
-    printf("dpos: (%.2f,%.2f)\tintern: (%.2f,%.2f)\textern: (%.2f,%.2f)\t gravity: %.2f\tparent: %p\n",
+    printf("dpos: (%.2f,%.2f)\tintern: (%.2f,%.2f)\textern: (%.2f,%.2f)\t gravity: %.2f\tparent: %d\n",
       ch->dpos.x, ch->dpos.y,
       ch->in.impulse.x, ch->in.impulse.y,
       ch->ex.impulse.x, ch->ex.impulse.y,
       ch->gravity.vel,
-      (void*)ch->group.object.parent
+      ch->group.object.parent.index
     );
   */
 
@@ -549,116 +550,14 @@ void loop_demo(demo *d) {
   } while (!d->input.quit);
 }
 
-void object_platform_relations(world *w);
-void move_platforms(world *w);
-void update_object_positions_on_platforms(world *w);
-void generate_collisions(world *w);
-void step_forces(world *w);
-void update_dpos(world *w);
-void integrate_forces(world *w);
-void solve_object_collisions(world *w);
-void solve_platform_collisions(world *w);
-void apply_dpos(world *w);
-void correct_positions(world *w);
-void reset_collisions(world *w);
-
-void step_world(world *w) {
-  // Define objects and platforms relationships
-  object_platform_relations(w);
-  // Move platforms (no collisions)
-  move_platforms(w);
-  // Assign objects' positions if on platform
-  update_object_positions_on_platforms(w);
-  // Step objects as normally
-  generate_collisions(w);
-  update_dpos(w);
-  apply_dpos(w);
-  step_forces(w);
-  solve_object_collisions(w);
-  //
-  object_platform_relations(w);
-  reset_collisions(w);
-  generate_collisions(w);
-  //
-  solve_platform_collisions(w);
-  correct_positions(w);
-  //
-  reset_collisions(w);
-}
-
-float normf(float x) {
-  return nearzerof(x) ? 0 : (x > 0 ? 1 : -1);
+void step_world(PfWorld *w, float elapsed) {
+  // Let the library relate, move, collide and solve in whole steps, the
+  // platform script runs before each of them
+  pf_world_advance(w, elapsed);
 }
 
-// TODO: into library
-bool try_child_connect_parent(const PfManifold *m, PfBody *a, PfBody *b) {
-  if (a->mass == 0 &&
-    b->mass != 0 &&
-    //(a->shape.tag == PF_SHAPE_RECT || (a->shape.tag == PF_SHAPE_TRI && b->shape.tag != PF_SHAPE_CIRCLE)) &&
-    !nearzerof(b->gravity.vel)
-    ) {
-    if (b->gravity.dir == PF_DIR_L || b->gravity.dir == PF_DIR_R) {
-      if (m->normal.y < -0.23) {
-        b->group.object.parent = a;
-        return true;
-      }
-    } else {
-      if (m->normal.y > 0.23) {
-        b->group.object.parent = a;
-        return true;
-      }
-    }
-  }
-  return false;
-}
-
-void object_platform_relations(world *w) {
-
-  for (int i = 0; i < w->body_num; i++) {
-    PfBody *a = &w->bodies[i];
-    PfManifold m;
-
-    // TODO: refactor (some may go into library)
-
-    // Decide to detach from parent
-    if (a->group.object.parent) {
-      //if (a->group.object.check_parent && !pf_solve_collision(a, a->group.object.parent, &m)) {
-      if (!pf_solve_collision(a, a->group.object.parent, &m)) {
-        a->group.object.parent = NULL;
-      }
-    }
-    
-    if (a->group.object.parent) {
-      continue;
-    }
- 
-    // Find parent to to attach
-    for (int j = 0; j < w->body_num; j++) {
-
-      PfBody *b = &w->bodies[j];
-      if (i == j || (a->mass == 0 && b->mass == 0)) {
-        continue;
-      }
-      if (pf_solve_collision(a, b, &m)) {
-
-        //const int MOVING_PLATFORM = 3;
-        //if ((i == MOVING_PLATFORM && m.normal.y >= 0) ||
-        //  (j == MOVING_PLATFORM && m.normal.y <= 0)) {
-        //  continue;
-        //}
-
-        v2f penetration = mulv2nf(m.normal, m.penetration);
-        // 0.00011 = magic number to stop jitter
-        penetration = subv2f(penetration, mulv2nf(m.normal, 0.00011));
-        if (try_child_connect_parent(&m, b, a)) {
-          a->pos = subv2f(a->pos, penetration);
-        }
-      }
-    }
-  }
-}
-
-void move_platforms(world *w) {
+void move_platforms(void *arg) {
+  PfWorld *w = arg;
   {
     static bool dir = false;
     static float delay = 0;
@@ -690,150 +589,9 @@ void move_platforms(world *w) {
     a->in.impulse = _v2f(cos(angle) * 4, sin(angle * 3) * 1);
   }
 */
-  for (int i = 0; i < w->body_num; i++) {
-    if (w->bodies[i].mode == PF_MODE_STATIC) {
-      pf_update_dpos(w->dt, &w->bodies[i]);
-      pf_apply_dpos(&w->bodies[i]);
-      pf_step_forces(w->dt, &w->bodies[i]);
-    }
-  }
-}
-
-void update_object_positions_on_platforms(world *w) {
-  for (int i = 0; i < w->body_num; i++) {
-    // TODO: into library
-    if (w->bodies[i].mode == PF_MODE_DYNAMIC &&
-      w->bodies[i].group.object.parent &&
-      w->bodies[i].group.object.parent->mode == PF_MODE_STATIC) {
-      w->bodies[i].pos = addv2f(w->bodies[i].pos, w->bodies[i].group.object.parent->dpos);
-    }
-  }
-}
-
-void generate_collisions(world *w) {
-  for (int i = 0; i < w->body_num; i++) {
-    const PfBody *a = &w->bodies[i];
-    for (int j = i + 1; j < w->body_num; j++) {
-      const PfBody *b = &w->bodies[j];
-      if (a->mass == 0 && b->mass == 0) {
-        continue;
-      }
-      keys_manifold *km = &w->manifolds[w->manifold_num];
-      if (pf_solve_collision(a, b, &km->manifold)) {
-        km->a_key = i;
-        km->b_key = j;
-
-        //IGNORE_MP
-        
-        w->manifold_num++;
-        if (w->manifold_num == MAX_MANIFOLDS) {
-          return;
-        }
-      }
-    }
-  }
-}
-
-void step_forces(world *w) {
-  for (int i = 0; i < w->body_num; i++) {
-    if (w->bodies[i].mode == PF_MODE_DYNAMIC) {
-      pf_step_forces(w->dt, &w->bodies[i]);
-    }
-  }
-}
-
-void solve_object_collisions(world *w) {
-  for (int it = 0; it < w->iterations; it++) {
-    for (int i = 0; i < w->manifold_num; i++) {
-      const keys_manifold *km = &w->manifolds[i];
-      const PfManifold *m = &km->manifold;
-      PfBody *a = &w->bodies[km->a_key];
-      PfBody *b = &w->bodies[km->b_key];
-
-      //IGNORE_MP
- 
-      // TODO: into library
-      if (!((a->mode == PF_MODE_STATIC || b->mode == PF_MODE_STATIC) &&
-         (a->group.object.parent != b && b->group.object.parent != a))) {
-        PfBody *item = &w->bodies[1]; // small circle
-        // bounce off other dynamic bodies
-        if (a != item && b != item && a->mode == PF_MODE_DYNAMIC && b->mode == PF_MODE_DYNAMIC) {
-          a->ex.impulse = subv2f(a->ex.impulse, mulv2nf(m->normal, m->penetration / w->iterations));
-          b->ex.impulse = addv2f(b->ex.impulse, mulv2nf(m->normal, m->penetration / w->iterations));
-        }
-        if (a != item && b != item && a->mode == PF_MODE_DYNAMIC && b->mode == PF_MODE_DYNAMIC) {
-          // don't let player bodies 'pop-up' if they're on a platform (which might be moving)
-          a->ex.impulse.y = 0;
-          b->ex.impulse.y = 0;
-        }
-        pf_apply_manifold(m, a, b);
-      }
-    }
-  }
-}
-
-void solve_platform_collisions(world *w) {
-  for (int it = 0; it < w->iterations; it++) {
-    for (int i = 0; i < w->manifold_num; i++) {
-      const keys_manifold *km = &w->manifolds[i];
-      const PfManifold *m = &km->manifold;
-      PfBody *a = &w->bodies[km->a_key];
-      PfBody *b = &w->bodies[km->b_key];
-  
-      //IGNORE_MP
-
-      // TODO: into library
-      if ((a->mode == PF_MODE_STATIC || b->mode == PF_MODE_STATIC) &&
-        (a->group.object.parent != b && b->group.object.parent != a)) {
-        // TODO: record adjustments
-        if (b->mode == PF_MODE_STATIC)
-          a->ex.impulse = subv2f(a->ex.impulse, mulv2nf(m->normal, m->penetration / w->iterations));
-        if (a->mode == PF_MODE_STATIC)
-          b->ex.impulse = addv2f(b->ex.impulse, mulv2nf(m->normal, m->penetration / w->iterations));
-      }
-    }
-  }
-}
-
-void update_dpos(world *w) {
-  for (int i = 0; i < w->body_num; i++) {
-    PfBody *a = &w->bodies[i];
-    if (a->mode == PF_MODE_DYNAMIC) {
-
-      pf_update_dpos(w->dt, a);
-    }
-  }
-}
-
-void apply_dpos(world *w) {
-  for (int i = 0; i < w->body_num; i++) {
-    if (w->bodies[i].mode == PF_MODE_DYNAMIC) {
-      pf_apply_dpos(&w->bodies[i]);
-    }
-  }
-}
-
-void correct_positions(world *w) {
-  for (int i = 0; i < w->manifold_num; i++) {
-    const keys_manifold *km = &w->manifolds[i];
-    const PfManifold *m = &km->manifold;
-
-
-    //IGNORE_MP
-
-    PfBody *a = &w->bodies[km->a_key];
-    PfBody *b = &w->bodies[km->b_key];
-    if (a->mode == PF_MODE_STATIC || b->mode == PF_MODE_STATIC) {
-      pf_pos_correction(m, a, b);
-    }
-  }
-}
-
-void reset_collisions(world *w) {
-  w->manifold_num = 0;
 }
 
-void foot_point_xy(const world *w, const FootPoint *fp, v2f *xy) {
+void foot_point_xy(const PfWorld *w, const FootPoint *fp, v2f *xy) {
   const PfBody *body = &w->bodies[fp->polyRef];
   const v2f pos = body->pos;
   const PfShape *shape = &body->shape;
@@ -934,9 +692,11 @@ void render_demo(demo *d) {
   SDL_RenderClear(d->renderer);
   SDL_SetRenderDrawColor(d->renderer, 0xff, 0xff, 0xff, 0xff);
 
+  // Draw bodies between their last two steps
+  const float alpha = pf_world_alpha(&d->world);
   // (8,6) are 1/8 of the main arena
-  const v2f p1_pos = clampv2f(_v2f(0, 0), _v2f(64, 48), d->world.bodies[0].pos);
-  const v2f p2_pos = clampv2f(_v2f(0, 0), _v2f(64, 48), d->world.bodies[2].pos);
+  const v2f p1_pos = clampv2f(_v2f(0, 0), _v2f(64, 48), pf_body_lerp_pos(&d->world.bodies[0], alpha));
+  const v2f p2_pos = clampv2f(_v2f(0, 0), _v2f(64, 48), pf_body_lerp_pos(&d->world.bodies[2], alpha));
 
   static v2f cam;
   static float angle = 0;
@@ -955,13 +715,22 @@ void render_demo(demo *d) {
   target = addv2f(mulv2nf(target, lerp_weight), mulv2nf(final_target, 1 - lerp_weight));
   cam = _v2f(SCREEN_W2 / scale - target.x, SCREEN_H2 / scale - target.y);
 
-  for (int i = 0; i < d->world.body_num; i++) {
-    const PfBody *a = &d->world.bodies[i];
+  // Only draw what the camera sees
+  static int visible[MAX_BODIES];
+  const PfAabb view = {
+    .min = negv2f(cam),
+    .max = subv2f(_v2f(SCREEN_W2 * 2 / scale, SCREEN_H2 * 2 / scale), cam),
+  };
+  const int visible_num = pf_world_query(&d->world, &view, visible);
+
+  for (int v = 0; v < visible_num; v++) {
+    const PfBody *a = &d->world.bodies[visible[v]];
+    const v2f pos = pf_body_lerp_pos(a, alpha);
     switch (a->shape.tag) {
     case PF_SHAPE_RECT: {
       SDL_Rect rect = {
-        .x = scale * (cam.x + a->pos.x - a->shape.radii.x),
-        .y = scale * (cam.y + a->pos.y - a->shape.radii.y),
+        .x = scale * (cam.x + pos.x - a->shape.radii.x),
+        .y = scale * (cam.y + pos.y - a->shape.radii.y),
         .w = scale * (a->shape.radii.x * 2.0f),
         .h = scale * (a->shape.radii.y * 2.0f),
       };
@@ -977,12 +746,12 @@ void render_demo(demo *d) {
         lines[i].x = scale
           * (
             cam.x +
-            (float)a->pos.x +
+            (float)pos.x +
             (float)a->shape.radius * cosf(theta));
         lines[i].y = scale
           * (
             cam.y +
-            (float)a->pos.y +
+            (float)pos.y +
             (float)a->shape.radius * sinf(theta));
       }
       lines[len - 1] = lines[0];
@@ -990,7 +759,7 @@ void render_demo(demo *d) {
       break;
     }
     case PF_SHAPE_TRI: {
-      PfAabb tri = pf_body_to_aabb(a);
+      PfAabb tri = pf_shape_to_aabb(&pos, &a->shape);
       const bool noLine = !a->shape.tri.line;
       tri.min = mulv2nf(addv2f(tri.min, cam), scale);
       tri.max = mulv2nf(addv2f(tri.max, cam), scale);
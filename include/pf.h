@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <ml.h>
 
 typedef struct {
@@ -10,6 +11,16 @@ typedef struct {
     v2f max;
 } PfAabb;
 
+// Bounds of many boxes, one array per bound
+typedef struct {
+    float *min_x;
+    float *min_y;
+    float *max_x;
+    float *max_y;
+    int num;
+    int cap;
+} PfAabbArray;
+
 typedef enum {
     PF_SHAPE_RECT,
     PF_SHAPE_CIRCLE,
@@ -76,20 +87,23 @@ typedef struct {
 
 struct PfBody;
 
-/*
-typedef enum {
-    PF_PLATFORM_NO_WAY,     // Solid platform
-    PF_PLATFORM_ONE_WAY,    // Jump-up-onto only platform
-    PF_PLATFORM_TWO_WAY,    // Jump-up and jump-down platform
-} PfPlatformTag;
-*/
+// Names a body wherever compaction moves it, stale once the body is destroyed.
+// Slot 0 is never used, so zeroed handles name nothing.
+typedef struct {
+    int index;              // Slot in the world's handle table
+    int generation;
+} PfHandle;
+
+#define PF_NO_HANDLE ((PfHandle) { .index = 0, .generation = 0 })
 
 typedef struct {
-    //PfPlatform_tag tag;
+    // Directions bodies pass through it in, solid if 0. A jump-up-onto
+    // platform allows PF_DIR_U | PF_DIR_L | PF_DIR_R, and adding PF_DIR_D
+    // while a character drops lets it jump down too.
     PfDir allow;
     v2f convey;
-    struct PfBody *left;
-    struct PfBody *right;
+    PfHandle left;
+    PfHandle right;
 } PfPlatform;
 
 typedef enum {
@@ -99,7 +113,7 @@ typedef enum {
 
 typedef struct PfObject {
     PfObjectTag tag;
-    struct PfBody const *parent;
+    PfHandle parent;
     bool check_parent;
 } PfObject;
 
@@ -112,10 +126,12 @@ typedef struct {
 } PfGroup;
 
 typedef struct  PfBody {
+    PfHandle handle;        // Its own, given by the world
     PfMode mode;
     PfGroup group;
     PfShape shape;
     v2f pos;
+    v2f prev_pos;           // Position before the last step, for interpolating
     v2f dpos;               // Change of position
     PfForce in;            // Internal/automonous
     PfForce ex;            // External
@@ -125,6 +141,11 @@ typedef struct  PfBody {
     float static_friction;
     float dynamic_friction;
     float restitution;
+    bool asleep;            // Left alone by the world until touched or pushed
+    int still;              // Steps in a row it barely moved
+    bool ccd;               // Sweeps its step so it can't tunnel through thin platforms
+    unsigned category;      // Layer bits it is on, bit 0 by default
+    unsigned mask;          // Layer bits it meets, all by default
 } PfBody;
 
 typedef struct {
@@ -135,22 +156,305 @@ typedef struct {
     float static_friction;
 } PfManifold;
 
+typedef struct {
+    int a_key;              // Index of first body
+    int b_key;              // Index of second body
+    PfManifold manifold;
+    float normal_impulse;   // Accumulated over solver passes, kept between steps
+    float tangent_impulse;
+    float bounce;           // Separating speed restitution asks for
+} PfContact;
+
+typedef struct {
+    float *x;
+    float *y;
+} PfV2fArray;
+
+// Integration state of every body, one array per field and axis, slot i for
+// the body at key i. It is what integration runs on: settings are read in
+// when a body starts moving, positions and impulses each step it moves.
+typedef struct {
+    int num;                // Slots integrated, the world's body_num
+    int cap;
+    PfV2fArray pos;
+    PfV2fArray dpos;
+    PfV2fArray in_impulse;
+    PfV2fArray ex_impulse;
+    PfV2fArray in_decay;
+    PfV2fArray ex_decay;
+    PfV2fArray in_min;      // Impulse caps
+    PfV2fArray in_max;
+    PfV2fArray ex_min;
+    PfV2fArray ex_max;
+    PfV2fArray gravity;     // Gravity direction as a unit v2f
+    float *gravity_accel;
+    float *gravity_cap;
+    float *gravity_vel;
+    float *inverse_mass;
+    int *massive;           // -1 if inverse mass is non-zero, else 0
+    int *attached;          // -1 if it has a parent, else 0
+    bool *moving;           // Integrated last step, settings are loaded
+} PfBodyStore;
+
+typedef struct {
+    int a;
+    int b;
+} PfPair;
+
+typedef struct {
+    PfPair *pairs;
+    int num;
+    int cap;
+} PfPairList;
+
+typedef struct {
+    int key;
+    int cx;
+    int cy;
+    int prev;               // Within bucket
+    int next;               // Within bucket
+    int sibling;            // Next cell of the same key
+} PfGridEntry;
+
+typedef struct {
+    PfAabb aabb;
+    int min_x;              // Covered cell range
+    int min_y;
+    int max_x;
+    int max_y;
+    int first;              // First entry, -1 if not inserted
+    bool fixed;             // Pairs of two fixed proxies are never reported
+    unsigned category;      // Pairs whose layers never meet are never reported
+    unsigned mask;
+} PfGridProxy;
+
+typedef struct {
+    float cell_size;
+    int *buckets;
+    int bucket_mask;
+    PfGridEntry *entries;
+    int entry_cap;
+    int free_entry;
+    PfGridProxy *proxies;
+    int proxy_num;          // One past the highest key in use
+    int proxy_cap;
+} PfGrid;
+
+typedef struct {
+    float value;
+    int key;
+    bool max;               // Max sorts after min at equal value
+} PfSapEndpoint;
+
+typedef struct {
+    PfAabb aabb;
+    bool fixed;             // Pairs of two fixed proxies are never reported
+    bool active;
+    unsigned category;      // Pairs whose layers never meet are never reported
+    unsigned mask;
+} PfSapProxy;
+
+typedef struct {
+    PfSapEndpoint *endpoints;   // Sorted x extents, kept between updates
+    int endpoint_num;
+    PfSapProxy *proxies;
+    int proxy_cap;
+    int *sweep;                 // Keys open during the sweep
+    PfPairList pairs;           // Overlapping now, sorted
+    PfPairList last;            // Overlapping at the previous report
+    PfPairList added;           // Overlapping now but not at the previous report
+    PfPairList removed;         // Overlapping at the previous report but not now
+} PfSap;
+
+typedef struct {
+    PfAabb aabb;
+    int left;               // Children, -1 for leaves
+    int right;
+    int parent;
+    int key;                // Body of a leaf, -1 for branches
+    unsigned category;      // Layers of the leaves under it, combined
+    unsigned mask;
+} PfBvhNode;
+
+typedef struct {
+    PfBvhNode *nodes;
+    int node_num;
+    int root;               // -1 if empty
+    int *leaves;            // Leaf node of each key, -1 if not in the tree
+    int key_cap;
+} PfBvh;
+
+typedef void (*PfJob)(void *arg, int index);
+typedef void (*PfStepHook)(void *arg);
+
+typedef struct {
+    pthread_t *threads;
+    int thread_num;         // Workers, the caller runs jobs too
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finish;
+    PfJob job;
+    void *arg;
+    int job_num;
+    int next_job;
+    int busy;               // Workers not done with the current batch
+    unsigned batch;
+    bool quit;
+} PfPool;
+
+// Parts of a step, PF_STATS times each
+typedef enum {
+    PF_PHASE_RELATIONS,     // Attaching objects to what they stand on
+    PF_PHASE_PLATFORMS,     // Moving platforms and what they carry
+    PF_PHASE_CONTACTS,      // Broadphase and narrowphase
+    PF_PHASE_SOLVE,         // Integrating and solving contacts
+    PF_PHASE_CORRECT,       // Position correction and sleep
+    PF_PHASE_NUM,
+} PfPhase;
+
+#define PF_SHAPE_TAG_NUM 3
+
+// What steps did since the last reset. Only builds with PF_STATS count,
+// others leave it zero and pay nothing.
+typedef struct {
+    int steps;
+    int pair_tests;         // Candidate pairs the broadphase found
+    // pf_solve_collision calls for contacts, parents, ground and sweeps, by
+    // the shape tags of each pair
+    int narrow_calls[PF_SHAPE_TAG_NUM][PF_SHAPE_TAG_NUM];
+    int manifolds;          // Contacts found
+    int solver_iterations;  // Passes over the contacts of awake islands
+    int contact_solves;
+    int attaches;
+    int detaches;
+    double phase_us[PF_PHASE_NUM];
+} PfStats;
+
+// One scope on one thread, in microseconds of CLOCK_MONOTONIC
+typedef struct {
+    const char *name;
+    unsigned long thread;   // pthread_self of the thread that ran it
+    double begin_us;
+    double end_us;
+} PfTraceEvent;
+
+// Ring of the latest events. Only builds with PF_TRACE record, and only
+// once pf_world_trace gave it room.
+typedef struct {
+    PfTraceEvent *events;
+    int cap;
+    unsigned next;          // Events ever recorded, the ring keeps the last cap
+} PfTrace;
+
+typedef enum {
+    PF_BROADPHASE_NONE,     // Test every pair
+    PF_BROADPHASE_GRID,
+    PF_BROADPHASE_SAP,
+} PfBroadphaseTag;
+
+typedef struct {
+    PfBody *bodies;         // Live bodies first to last, destroying moves the last into the gap
+    int body_num;
+    int body_cap;
+    int *handle_key;        // Body of each handle slot, -1 if free
+    int *handle_generation; // Bumped when a slot's body is destroyed
+    int *free_handles;      // Freed slots, the last freed is reused first
+    int free_handle_num;
+    int handle_num;         // Slots ever used, slot 0 included
+    int statics_version;    // Bumped when the static tree changes members
+    PfContact *contacts;
+    int contact_num;
+    int contact_cap;
+    PfContact *cache;       // Solved contacts of the last step, sorted by pair
+    int cache_num;
+    bool *stale;            // Keys whose cached contacts belong to a destroyed or moved body
+    int *stale_keys;        // Keys set in stale, cleared when the cache is rebuilt
+    int stale_num;
+    float dt;
+    float accumulator;      // Elapsed time not stepped yet, less than dt between advances
+    int max_steps;          // Most steps one advance runs, older time is dropped
+    PfStepHook before_step; // Run by advance before each step, for scripts that move bodies
+    void *step_arg;
+    int iterations;         // Solver passes per step
+    int sleep_steps;        // Steps a body must stay still to fall asleep, 0 never
+    PfBroadphaseTag broadphase;
+    PfGrid grid;
+    PfSap sap;
+    PfBvh statics;          // Level geometry, kept out of the broadphase
+    int *loose;             // Massless bodies outside the static tree
+    int loose_num;
+    PfPairList pairs;       // Broadphase candidates
+    PfPairList support;     // Parent candidates of one body
+    PfBodyStore store;      // What integration runs on
+    PfAabbArray boxes;      // Bounds of every body, for batch queries
+    PfAabbArray loose_boxes;
+    PfAabbArray swept;      // Bounds static bodies moved through this step
+    int *hits;              // Batch query results
+    PfPool pool;
+    PfContact *narrow;      // Narrowphase output, one fixed chunk of pairs each
+    int *narrow_num;        // Contacts found per chunk
+    int narrow_cap;         // Pairs the chunks can hold
+    int *island_root;       // Union-find over bodies
+    int *island_id;         // Island of each root, -1 if none
+    int *island_of;         // Island of each contact
+    int *island_start;      // First of each island in island_contacts, island_num + 1 of them
+    int *island_contacts;   // Contact indices grouped by island
+    int island_num;
+    PfStats stats;          // Read and reset by the host
+    PfTrace trace;
+    double step_start_us;   // PF_STATS and PF_TRACE builds time the running step
+    double phase_start_us;
+} PfWorld;
+
+// What a step carries over to the next
+typedef struct {
+    PfBody *bodies;
+    int body_num;
+    int body_cap;
+    int *handle_key;
+    int *handle_generation;
+    int *free_handles;
+    int free_handle_num;
+    int handle_num;
+    int statics_version;
+    PfContact *cache;
+    int cache_num;
+    float accumulator;
+} PfSnapshot;
+
 bool pf_intersect(const PfAabb *a, const PfAabb *b);
 bool pf_inside(const v2f *a, const PfAabb *b);
+int pf_aabb_query_batch(const PfAabb *q, const float *min_x, const float *min_y,
+                        const float *max_x, const float *max_y, int n, int *out);
+bool pf_aabb_array_init(PfAabbArray *a, int cap);
+void pf_aabb_array_free(PfAabbArray *a);
+bool pf_aabb_array_push(PfAabbArray *a, const PfAabb *box);
+int pf_aabb_array_query(const PfAabbArray *a, const PfAabb *q, int *out);
 v2f pf_aabb_pos(const PfAabb *a);
+PfAabb pf_rect_to_aabb(const v2f *pos, const v2f *radii);
+PfAabb pf_circle_to_aabb(const v2f *pos, float radius);
+PfAabb pf_tri_to_aabb(const v2f *pos, const PfTri *tri);
+PfAabb pf_shape_to_aabb(const v2f *pos, const PfShape *sh);
 PfAabb pf_body_to_aabb(const PfBody *a);
 bool pf_test_body(const PfAabb *a, const PfBody *b);
 bool pf_body_to_body(const PfBody *a, const PfBody *b, v2f *normal, float *penetration);
 bool pf_solve_collision(const PfBody *a, const PfBody *b, PfManifold *m);
+bool pf_layer_bits_meet(unsigned a_category, unsigned a_mask, unsigned b_category, unsigned b_mask);
+bool pf_layers_meet(const PfBody *a, const PfBody *b);
+float pf_sweep_aabb(const PfAabb *a, v2f d, const PfAabb *b, v2f *normal);
+float pf_time_of_impact(const PfBody *a, v2f d, const PfBody *b, v2f *normal);
 v2f pf_gravity_v2f(PfDir dir, float vel);
 
 void pf_step_forces(float dt, PfBody *a);
 void pf_apply_manifold(const PfManifold *m, PfBody *a, PfBody *b);
+void pf_apply_contact(PfContact *c, PfBody *a, PfBody *b);
+void pf_warm_start(PfContact *c, PfBody *a, PfBody *b);
 void pf_update_dpos(float dt, PfBody *a);
 void pf_apply_dpos(PfBody *a);
 void pf_pos_correction(const PfManifold *m, PfBody *a, PfBody *b);
 
 void pf_body_set_mass(float mass, PfBody *a);
+void pf_body_wake(PfBody *a);
 void pf_body_esque(float density, float restitution, PfBody *a);
 void pf_rock_esque(PfBody *a);
 void pf_wood_esque(PfBody *a);
@@ -171,9 +475,87 @@ bool pf_test_tri(const PfAabb *a, const v2f *pos, const PfTri *t);
 bool pf_rect_to_tri(const PfBody *a, const PfBody *b, v2f *normal, float *penetration);
 float pf_line_point_dist(float p_m, float p_b, float q_x, float q_y);
 PfAabb _to_aabb(const PfBody *a);
-void pf_transform_move_on_slope(PfBody *a, float dt);
+void pf_transform_move_on_slope(const PfWorld *w, PfBody *a, float dt);
+bool pf_handle_eq(PfHandle a, PfHandle b);
+bool pf_handle_none(PfHandle h);
 
 v2f pf_move_left_on_slope_transform(const PfTri *t);
 v2f pf_move_right_on_slope_transform(const PfTri *t);
 
+bool pf_supports(const PfManifold *m, const PfBody *parent, const PfBody *child);
+bool pf_try_connect_parent(const PfManifold *m, PfBody *parent, PfBody *child);
+PfAabb pf_body_feet(const PfBody *a);
+
+
+bool pf_store_init(PfBodyStore *s, int cap);
+void pf_store_free(PfBodyStore *s);
+void pf_store_rest(PfBodyStore *s, int key);
+void pf_store_load(PfBodyStore *s, int key, const PfBody *a);
+void pf_store_pull(PfBodyStore *s, int key, const PfBody *a);
+void pf_store_push(const PfBodyStore *s, int key, PfBody *a);
+void pf_store_update_dpos(float dt, PfBodyStore *s);
+void pf_store_apply_dpos(PfBodyStore *s);
+void pf_store_step_forces(float dt, PfBodyStore *s);
+
+bool pf_pair_list_push(PfPairList *l, int a, int b);
+void pf_pair_list_sort(PfPairList *l);
+void pf_pair_list_free(PfPairList *l);
+
+bool pf_grid_init(PfGrid *g, float cell_size, int proxy_cap);
+void pf_grid_free(PfGrid *g);
+bool pf_grid_update(PfGrid *g, int key, const PfAabb *aabb, bool fixed, unsigned category, unsigned mask);
+void pf_grid_remove(PfGrid *g, int key);
+bool pf_grid_find_pairs(const PfGrid *g, PfPairList *out);
+
+bool pf_sap_init(PfSap *s, int proxy_cap);
+void pf_sap_free(PfSap *s);
+void pf_sap_update(PfSap *s, int key, const PfAabb *aabb, bool fixed, unsigned category, unsigned mask);
+void pf_sap_remove(PfSap *s, int key);
+bool pf_sap_find_pairs(PfSap *s);
+bool pf_sap_report(PfSap *s);
+
+bool pf_bvh_build(PfBvh *t, const int *keys, const PfAabb *boxes, const unsigned *categories, const unsigned *masks, int n, int key_cap);
+void pf_bvh_free(PfBvh *t);
+void pf_bvh_rekey(PfBvh *t, int from, int to);
+void pf_bvh_refit(PfBvh *t, int key, const PfAabb *aabb);
+bool pf_bvh_query(const PfBvh *t, const PfAabb *box, int key, unsigned category, unsigned mask, PfPairList *out);
+int pf_bvh_collect(const PfBvh *t, const PfAabb *box, int *out);
+
+bool pf_pool_init(PfPool *p, int thread_num);
+void pf_pool_free(PfPool *p);
+void pf_pool_run(PfPool *p, PfJob job, void *arg, int job_num);
+
+bool pf_world_init(PfWorld *w, int body_cap);
+void pf_world_free(PfWorld *w);
+bool pf_world_use_grid(PfWorld *w, float cell_size);
+bool pf_world_use_sap(PfWorld *w);
+bool pf_world_build_static_tree(PfWorld *w);
+void pf_world_refit_static(PfWorld *w, int key);
+void pf_world_use_brute_force(PfWorld *w);
+bool pf_world_use_threads(PfWorld *w, int thread_num);
+PfBody* pf_world_add_body(PfWorld *w);
+PfHandle pf_world_create_body(PfWorld *w);
+bool pf_world_destroy_body(PfWorld *w, PfHandle h);
+PfBody* pf_world_get(const PfWorld *w, PfHandle h);
+void pf_world_reload_body(PfWorld *w, PfHandle h);
+int pf_world_query(const PfWorld *w, const PfAabb *box, int *out);
+const PfBody* pf_world_find_ground(PfWorld *w, int key);
+void pf_world_step(PfWorld *w, float dt);
+int pf_world_advance(PfWorld *w, float elapsed);
+float pf_world_alpha(const PfWorld *w);
+v2f pf_body_lerp_pos(const PfBody *a, float alpha);
+unsigned pf_world_checksum(const PfWorld *w);
+void pf_world_reset_stats(PfWorld *w);
+bool pf_world_trace(PfWorld *w, int cap);
+bool pf_world_dump_trace(const PfWorld *w, const char *path);
+
+bool pf_snapshot_init(PfSnapshot *s, int body_cap);
+void pf_snapshot_free(PfSnapshot *s);
+bool pf_world_snapshot(const PfWorld *w, PfSnapshot *s);
+void pf_world_restore(PfWorld *w, const PfSnapshot *s);
+bool pf_world_save_level(const PfWorld *w, const char *path);
+bool pf_world_copy_level(PfWorld *w, const char *path);
+size_t pf_world_encode(const PfWorld *w, const PfSnapshot *base, unsigned char *out, size_t cap);
+bool pf_world_decode(PfWorld *w, const PfSnapshot *base, const unsigned char *in, size_t size);
+
 #endif
@@ -1,7 +1,114 @@
 #include "pf.h"
 #include <math.h>
 #include <assert.h>
+#include <float.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// PF_DETERMINISTIC makes steps bit-reproducible across runs, compilers and CPUs.
+// Every build takes the scalar loops and avoids libm's trig, the compiler must
+// keep strict IEEE float (make deterministic).
+#ifdef PF_DETERMINISTIC
+#ifdef __FAST_MATH__
+#error "PF_DETERMINISTIC needs a build without -ffast-math"
+#endif
+#if defined(__FLT_EVAL_METHOD__) && __FLT_EVAL_METHOD__ != 0
+#error "PF_DETERMINISTIC needs floats evaluated as floats, e.g. -mfpmath=sse"
+#endif
+#ifndef PF_NO_SIMD
+#define PF_NO_SIMD
+#endif
+#endif
+
+// PF_STATS fills PfWorld.stats as steps run, without it counting compiles out
+#ifdef PF_STATS
+#define PF_STATS_ADD(w, field, n) ((w)->stats.field += (n))
+#define PF_STATS_NARROW(w, a, b, n) ((w)->stats.narrow_calls[(a)->shape.tag][(b)->shape.tag] += (n))
+#define PF_STATS_SOLVES(w) pf_stats_solves(w)
+#else
+#define PF_STATS_ADD(w, field, n) ((void)0)
+#define PF_STATS_NARROW(w, a, b, n) ((void)(w))
+#define PF_STATS_SOLVES(w) ((void)0)
+#endif
+
+// PF_TRACE records step phases and pool jobs into PfWorld.trace
+#ifdef PF_TRACE
+#define PF_TRACE_BEGIN() const double pf_trace_begin_us = pf_now_us()
+#define PF_TRACE_END(w, name) pf_trace_push(&(w)->trace, (name), pf_trace_begin_us, pf_now_us())
+#define PF_TRACE_STEP(w) pf_trace_push(&(w)->trace, "step", (w)->step_start_us, (w)->phase_start_us)
+#else
+#define PF_TRACE_BEGIN() ((void)0)
+#define PF_TRACE_END(w, name) ((void)0)
+#define PF_TRACE_STEP(w) ((void)0)
+#endif
+
+#if defined(PF_STATS) || defined(PF_TRACE)
+#define PF_PHASE_START(w) pf_world_phase_start(w)
+#define PF_PHASE_END(w, phase) pf_world_phase_end(w, phase)
+#else
+#define PF_PHASE_START(w) ((void)0)
+#define PF_PHASE_END(w, phase) ((void)0)
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Lanes for the batch kernels. Define PF_NO_SIMD to build only the scalar loops.
+#if defined(__AVX__) && !defined(PF_NO_SIMD)
+#define PF_LANES 8
+typedef __m256 PfLane;
+#define pf_lane_load(p) _mm256_loadu_ps(p)
+#define pf_lane_store(p, v) _mm256_storeu_ps(p, v)
+#define pf_lane_mask(p) _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(p)))
+#define pf_lane_fill(n) _mm256_set1_ps(n)
+#define pf_lane_add(a, b) _mm256_add_ps(a, b)
+#define pf_lane_mul(a, b) _mm256_mul_ps(a, b)
+#define pf_lane_min(a, b) _mm256_min_ps(a, b)
+#define pf_lane_max(a, b) _mm256_max_ps(a, b)
+#define pf_lane_xor(a, b) _mm256_xor_ps(a, b)
+#define pf_lane_nonzero(a) _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_NEQ_UQ)
+#define pf_lane_select(m, a, b) _mm256_blendv_ps(b, a, m)
+#define pf_lane_and(a, b) _mm256_and_ps(a, b)
+#define pf_lane_le(a, b) _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define pf_lane_bits(m) _mm256_movemask_ps(m)
+#elif defined(__SSE2__) && !defined(PF_NO_SIMD)
+#define PF_LANES 4
+typedef __m128 PfLane;
+#define pf_lane_load(p) _mm_loadu_ps(p)
+#define pf_lane_store(p, v) _mm_storeu_ps(p, v)
+#define pf_lane_mask(p) _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(p)))
+#define pf_lane_fill(n) _mm_set1_ps(n)
+#define pf_lane_add(a, b) _mm_add_ps(a, b)
+#define pf_lane_mul(a, b) _mm_mul_ps(a, b)
+#define pf_lane_min(a, b) _mm_min_ps(a, b)
+#define pf_lane_max(a, b) _mm_max_ps(a, b)
+#define pf_lane_xor(a, b) _mm_xor_ps(a, b)
+#define pf_lane_nonzero(a) _mm_cmpneq_ps(a, _mm_setzero_ps())
+#define pf_lane_select(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+#define pf_lane_and(a, b) _mm_and_ps(a, b)
+#define pf_lane_le(a, b) _mm_cmple_ps(a, b)
+#define pf_lane_bits(m) _mm_movemask_ps(m)
+#else
+#define PF_LANES 1
+#endif
+
+// Penetration left alone so resting contacts are still found next step
+#define PF_SLOP 0.01f
+// Most steps and bisections a time of impact query takes
+#define PF_TOI_STEPS 32
+#define PF_TOI_ITERATIONS 8
+// Sweeps a ccd body makes per step, each slides along what stopped the last
+#define PF_SWEEP_PASSES 2
+// Steps per unit of encoded positions and speeds, a power of two so values
+// within 16384 units decode exactly
+#define PF_QUANTUM 1024.0f
+#define PF_QUANTUM_MAX 1073741823.0f
+// Nodes a static tree walk keeps pending, levels whose tree needs more are refused
+#define PF_BVH_STACK 64
 
 typedef enum {
     PF_TRI_REGION_AB,
@@ -35,6 +142,81 @@ bool pf_inside(const v2f *a, const PfAabb *b) {
         a->y >= b->min.y && a->y <= b->max.y;
 }
 
+// Writes the index of every box overlapping q to out in order, returns how many
+int pf_aabb_query_batch(const PfAabb *q, const float *min_x, const float *min_y,
+                        const float *max_x, const float *max_y, int n, int *out) {
+    int i = 0;
+    int k = 0;
+#if PF_LANES > 1
+    const PfLane q_min_x = pf_lane_fill(q->min.x);
+    const PfLane q_min_y = pf_lane_fill(q->min.y);
+    const PfLane q_max_x = pf_lane_fill(q->max.x);
+    const PfLane q_max_y = pf_lane_fill(q->max.y);
+    for (; i + PF_LANES <= n; i += PF_LANES) {
+        const PfLane x = pf_lane_and(
+            pf_lane_le(pf_lane_load(min_x + i), q_max_x),
+            pf_lane_le(q_min_x, pf_lane_load(max_x + i)));
+        const PfLane y = pf_lane_and(
+            pf_lane_le(pf_lane_load(min_y + i), q_max_y),
+            pf_lane_le(q_min_y, pf_lane_load(max_y + i)));
+        const int bits = pf_lane_bits(pf_lane_and(x, y));
+        // Write every lane, only advance past hits
+        for (int b = 0; b < PF_LANES; b++) {
+            out[k] = i + b;
+            k += (bits >> b) & 1;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        out[k] = i;
+        k +=
+            min_x[i] <= q->max.x && q->min.x <= max_x[i] &&
+            min_y[i] <= q->max.y && q->min.y <= max_y[i];
+    }
+    return k;
+}
+
+bool pf_aabb_array_init(PfAabbArray *a, int cap) {
+    *a = (PfAabbArray) {
+        .min_x = malloc(sizeof(float) * cap),
+        .min_y = malloc(sizeof(float) * cap),
+        .max_x = malloc(sizeof(float) * cap),
+        .max_y = malloc(sizeof(float) * cap),
+        .num = 0,
+        .cap = cap,
+    };
+    if (!a->min_x || !a->min_y || !a->max_x || !a->max_y) {
+        pf_aabb_array_free(a);
+        return false;
+    }
+    return true;
+}
+
+void pf_aabb_array_free(PfAabbArray *a) {
+    free(a->min_x);
+    free(a->min_y);
+    free(a->max_x);
+    free(a->max_y);
+    *a = (PfAabbArray) { .num = 0 };
+}
+
+bool pf_aabb_array_push(PfAabbArray *a, const PfAabb *box) {
+    if (a->num == a->cap) {
+        return false;
+    }
+    a->min_x[a->num] = box->min.x;
+    a->min_y[a->num] = box->min.y;
+    a->max_x[a->num] = box->max.x;
+    a->max_y[a->num] = box->max.y;
+    a->num++;
+    return true;
+}
+
+// out must hold a->num indices
+int pf_aabb_array_query(const PfAabbArray *a, const PfAabb *q, int *out) {
+    return pf_aabb_query_batch(q, a->min_x, a->min_y, a->max_x, a->max_y, a->num, out);
+}
+
 float pf_line_point_dist(float p_m, float p_b, float q_x, float q_y) {
     const float q_m = -1.0 / p_m;
     const float q_b = q_y - (q_m * q_x);
@@ -82,6 +264,21 @@ v2f projection_vector(float radians) {
     return _v2f(cosf(radians), -sinf(radians));
 }
 
+// Sine and cosine of tri_angle from the radii alone, so no libm is involved
+v2f tri_sin_cos(const v2f *radii, PfCorner hypotenuse) {
+    const float h = sqrtf(radii->x * radii->x + radii->y * radii->y);
+    switch (hypotenuse) {
+    case PF_CORNER_UL:
+    case PF_CORNER_DR:
+        return _v2f(-radii->x / h, radii->y / h);
+    case PF_CORNER_UR:
+    case PF_CORNER_DL:
+        return _v2f(radii->x / h, radii->y / h);
+    default:
+        assert(false);
+    }
+}
+
 PfAabb pf_rect_to_aabb(const v2f *pos, const v2f *radii) {
     return (PfAabb) {
         .min = subv2f(*pos, *radii),
@@ -92,7 +289,7 @@ PfAabb pf_rect_to_aabb(const v2f *pos, const v2f *radii) {
 PfAabb pf_circle_to_aabb(const v2f *pos, float radius) {
     return (PfAabb) {
         .min = subv2nf(*pos, radius),
-        .max = divv2nf(*pos, radius)
+        .max = addv2f(*pos, fillv2f(radius))
     };
 }
 
@@ -523,14 +720,76 @@ bool pf_test_body(const PfAabb *a, const PfBody *b) {
 }
 
 bool pf_body_to_body_swap(const PfBody *a, const PfBody *b, v2f *normal, float *penetration);
+bool pf_shape_to_shape(const PfBody *a, const PfBody *b, v2f *normal, float *penetration);
 bool pf_rect_to_rect(const PfBody *a, const PfBody *b, v2f *normal, float *penetration);
 bool pf_rect_to_circle(const PfBody *a, const PfBody *b, v2f *normal, float *penetration);
 bool pf_rect_to_tri(const PfBody *a, const PfBody *b, v2f *normal, float *penetration);
 bool pf_circle_to_circle(const PfBody *a, const PfBody *b, v2f *normal, float *penetration);
 bool pf_circle_to_tri(const PfBody *a, const PfBody *b, v2f *normal, float *penetration);
 
+// Only static bodies are platforms, dynamic ones hold an object whatever
+// their group tag says
+bool pf_is_one_way(const PfBody *a) {
+    return a->mode == PF_MODE_STATIC && a->group.tag == PF_GROUP_PLATFORM &&
+        a->group.platform.allow != 0;
+}
+
+// Directions one-way platform a stops bodies moving in
+PfDir pf_one_way_block(const PfBody *a) {
+    return (PF_DIR_U | PF_DIR_D | PF_DIR_L | PF_DIR_R) & ~a->group.platform.allow;
+}
+
+// Whether d has a component along one of dirs
+bool pf_dir_along(PfDir dirs, v2f d) {
+    return ((dirs & PF_DIR_U) && d.y < 0) || ((dirs & PF_DIR_D) && d.y > 0) ||
+        ((dirs & PF_DIR_L) && d.x < 0) || ((dirs & PF_DIR_R) && d.x > 0);
+}
+
+// Whether one-way platform b stops a body with box from before moving d
+// relative to it: it moves into a side b blocks, or was clear of b there
+bool pf_one_way_stops(const PfBody *b, const PfAabb *from, v2f d) {
+    const PfDir block = pf_one_way_block(b);
+    const PfAabb box = pf_body_to_aabb(b);
+    return pf_dir_along(block, d) ||
+        ((block & PF_DIR_D) && from->max.y <= box.min.y + PF_SLOP) ||
+        ((block & PF_DIR_U) && from->min.y >= box.max.y - PF_SLOP) ||
+        ((block & PF_DIR_R) && from->max.x <= box.min.x + PF_SLOP) ||
+        ((block & PF_DIR_L) && from->min.x >= box.max.x - PF_SLOP);
+}
+
+// Whether one-way platform b stops a this step
+bool pf_one_way_meets(const PfBody *a, const PfBody *b) {
+    // Bodies riding the platform stay on it however it moves
+    if (a->mode == PF_MODE_DYNAMIC && !pf_handle_none(a->group.object.parent) &&
+        pf_handle_eq(a->group.object.parent, b->handle)) {
+        return true;
+    }
+    const v2f d = subv2f(a->dpos, b->dpos);
+    PfAabb from = pf_body_to_aabb(a);
+    from.min = subv2f(from.min, d);
+    from.max = subv2f(from.max, d);
+    return pf_one_way_stops(b, &from, d);
+}
+
+// One-way platforms only stop bodies moving into, or coming from, a side
+// they block, and only push them back out of that side. Other pairs are
+// rejected here, so the solver never sees a manifold it has to undo.
 bool pf_body_to_body(const PfBody *a, const PfBody *b,
              v2f *normal, float *penetration) {
+    if (pf_is_one_way(b)) {
+        return pf_one_way_meets(a, b) &&
+            pf_shape_to_shape(a, b, normal, penetration) &&
+            pf_dir_along(pf_one_way_block(b), *normal);
+    } else if (pf_is_one_way(a)) {
+        return pf_one_way_meets(b, a) &&
+            pf_shape_to_shape(a, b, normal, penetration) &&
+            pf_dir_along(pf_one_way_block(a), negv2f(*normal));
+    }
+    return pf_shape_to_shape(a, b, normal, penetration);
+}
+
+bool pf_shape_to_shape(const PfBody *a, const PfBody *b,
+             v2f *normal, float *penetration) {
     switch (a->shape.tag) {
     case PF_SHAPE_RECT:
         switch (b->shape.tag) {
@@ -570,7 +829,7 @@ bool pf_body_to_body(const PfBody *a, const PfBody *b,
 }
 
 bool pf_body_to_body_swap(const PfBody *a, const PfBody *b, v2f *normal, float *penetration) {
-    const bool test = pf_body_to_body(b, a, normal, penetration);
+    const bool test = pf_shape_to_shape(b, a, normal, penetration);
     if (test) {
         *normal = negv2f(*normal);
     }
@@ -1079,6 +1338,15 @@ inline v2f pf_aabb_pos(const PfAabb *a) {
     return divv2nf(addv2f(a->min, a->max), 2);
 }
 
+// Each has to be on a layer the other meets, or they never touch
+bool pf_layer_bits_meet(unsigned a_category, unsigned a_mask, unsigned b_category, unsigned b_mask) {
+    return (a_category & b_mask) && (b_category & a_mask);
+}
+
+bool pf_layers_meet(const PfBody *a, const PfBody *b) {
+    return pf_layer_bits_meet(a->category, a->mask, b->category, b->mask);
+}
+
 bool pf_solve_collision(const PfBody *a, const PfBody *b, PfManifold *m) {
     if (pf_body_to_body(a, b, &m->normal, &m->penetration)) {
         if (fabsf(m->penetration) < 0.0001) {
@@ -1092,6 +1360,115 @@ bool pf_solve_collision(const PfBody *a, const PfBody *b, PfManifold *m) {
     return false;
 }
 
+// Fraction of d box a moves before touching b, 0 if they overlap, 1 if never
+float pf_sweep_aabb(const PfAabb *a, v2f d, const PfAabb *b, v2f *normal) {
+    const float a_min[2] = {a->min.x, a->min.y};
+    const float a_max[2] = {a->max.x, a->max.y};
+    const float b_min[2] = {b->min.x, b->min.y};
+    const float b_max[2] = {b->max.x, b->max.y};
+    const float dir[2] = {d.x, d.y};
+    float enter = -FLT_MAX;
+    float leave = FLT_MAX;
+    int axis = 0;
+    for (int k = 0; k < 2; k++) {
+        if (dir[k] == 0) {
+            if (a_max[k] <= b_min[k] || a_min[k] >= b_max[k]) {
+                return 1;
+            }
+            continue;
+        }
+        const float near = ((dir[k] > 0 ? b_min[k] - a_max[k] : b_max[k] - a_min[k])) / dir[k];
+        const float far = ((dir[k] > 0 ? b_max[k] - a_min[k] : b_min[k] - a_max[k])) / dir[k];
+        if (near > enter) {
+            enter = near;
+            axis = k;
+        }
+        leave = fminf(leave, far);
+    }
+    if (enter > leave || enter >= 1 || leave <= 0) {
+        return 1;
+    }
+    *normal = axis == 0 ? _v2f(d.x < 0 ? -1 : 1, 0) : _v2f(0, d.y < 0 ? -1 : 1);
+    return fmaxf(0, enter);
+}
+
+float pf_shape_min_radius(const PfShape *sh) {
+    switch (sh->tag) {
+    case PF_SHAPE_RECT:
+        return fminf(sh->radii.x, sh->radii.y);
+    case PF_SHAPE_CIRCLE:
+        return sh->radius;
+    case PF_SHAPE_TRI:
+        return fminf(sh->tri.radii.x, sh->tri.radii.y);
+    default:
+        assert(false);
+    }
+}
+
+// Fraction of d body a moves before touching b, 1 if it never does or already touches.
+// Boxes are swept exactly, other shapes march from where their bounds meet in steps
+// shorter than a, then bisect the step that first touches. calls gets how many
+// pf_solve_collision calls that took.
+float pf_time_of_impact_calls(const PfBody *a, v2f d, const PfBody *b, v2f *normal, int *calls) {
+    PfManifold m;
+    *calls = 0;
+    if (nearzerof(lenv2f(d))) {
+        return 1;
+    }
+    *calls += 1;
+    if (pf_solve_collision(a, b, &m)) {
+        return 1;
+    }
+    const PfAabb a_box = pf_body_to_aabb(a);
+    const PfAabb b_box = pf_body_to_aabb(b);
+    // The box sweep below skips pf_body_to_body and its one-way rejection
+    if (pf_is_one_way(b) && !pf_one_way_stops(b, &a_box, d)) {
+        return 1;
+    }
+    const float enter = pf_sweep_aabb(&a_box, d, &b_box, normal);
+    if (enter >= 1 || (a->shape.tag == PF_SHAPE_RECT && b->shape.tag == PF_SHAPE_RECT)) {
+        return enter < 1 && pf_is_one_way(b) && !pf_dir_along(pf_one_way_block(b), *normal) ? 1 : enter;
+    }
+    const float len = lenv2f(d);
+    const float step = fmaxf(pf_shape_min_radius(&a->shape), len / PF_TOI_STEPS) / len;
+    PfBody moved = *a;
+    float free = enter;
+    float hit = 1;
+    bool found = false;
+    for (float t = enter; !found; t = fminf(1, t + step)) {
+        moved.pos = addv2f(a->pos, mulv2nf(d, t));
+        *calls += 1;
+        if (pf_solve_collision(&moved, b, &m)) {
+            hit = t;
+            found = true;
+        } else if (t == 1) {
+            return 1;
+        } else {
+            free = t;
+        }
+    }
+    for (int k = 0; k < PF_TOI_ITERATIONS; k++) {
+        const float t = (free + hit) / 2;
+        moved.pos = addv2f(a->pos, mulv2nf(d, t));
+        *calls += 1;
+        if (pf_solve_collision(&moved, b, &m)) {
+            hit = t;
+        } else {
+            free = t;
+        }
+    }
+    moved.pos = addv2f(a->pos, mulv2nf(d, hit));
+    *calls += 1;
+    pf_solve_collision(&moved, b, &m);
+    *normal = m.normal;
+    return free;
+}
+
+float pf_time_of_impact(const PfBody *a, v2f d, const PfBody *b, v2f *normal) {
+    int calls;
+    return pf_time_of_impact_calls(a, d, b, normal, &calls);
+}
+
 v2f pf_gravity_v2f(PfDir dir, float vel) {
     switch (dir) {
     case PF_DIR_U:
@@ -1111,7 +1488,7 @@ void pf_step_forces(float dt, PfBody *a) {
     if (!nearzerof(a->inverse_mass)) {
         a->in.impulse = mulv2f(a->in.impulse, a->in.decay);
         a->ex.impulse = mulv2f(a->ex.impulse, a->ex.decay);
-        if (!a->group.object.parent) {
+        if (pf_handle_none(a->group.object.parent)) {
             a->gravity.vel = a->gravity.vel + (a->gravity.accel * dt / 2);
         } else {
             a->gravity.vel = 0;
@@ -1131,7 +1508,7 @@ void pf_update_dpos(float dt, PfBody *a) {
 
         a->dpos = mulv2nf(a->in.impulse, dt);
         a->dpos = addv2f(a->dpos, mulv2nf(a->ex.impulse, dt));
-        if (!a->group.object.parent) {
+        if (pf_handle_none(a->group.object.parent)) {
             a->dpos = addv2f(a->dpos, pf_gravity_v2f(a->gravity.dir, a->gravity.vel));
         }
     } else {
@@ -1146,8 +1523,7 @@ void pf_apply_dpos(PfBody *a) {
 
 void pf_pos_correction(const PfManifold *m, PfBody *a,  PfBody *b) {
     float percent = 0.2;
-    float slop = 0.01;
-    float adjust = (m->penetration - slop) / (a->inverse_mass + b->inverse_mass);
+    float adjust = (m->penetration - PF_SLOP) / (a->inverse_mass + b->inverse_mass);
     const v2f correction = mulv2nf(m->normal, fmaxf(0, adjust) * percent);
     a->pos = subv2f(a->pos, mulv2nf(correction, a->inverse_mass));
     b->pos = addv2f(b->pos, mulv2nf(correction, b->inverse_mass));
@@ -1185,6 +1561,60 @@ void pf_apply_manifold(const PfManifold *m, PfBody *a, PfBody *b) {
     b->ex.impulse = addv2f(b->ex.impulse, mulv2nf(tagent_impulse, b->inverse_mass));
 }
 
+// Massless bodies are left untouched, islands share them between threads
+void pf_contact_push(v2f impulse, PfBody *a, PfBody *b) {
+    if (a->inverse_mass != 0) {
+        a->ex.impulse = subv2f(a->ex.impulse, mulv2nf(impulse, a->inverse_mass));
+    }
+    if (b->inverse_mass != 0) {
+        b->ex.impulse = addv2f(b->ex.impulse, mulv2nf(impulse, b->inverse_mass));
+    }
+}
+
+// Applies the impulses a contact ended the last step with
+void pf_warm_start(PfContact *c, PfBody *a, PfBody *b) {
+    const PfManifold *m = &c->manifold;
+    const float e = fminf(a->restitution, b->restitution);
+    const float contact_velocity = dotv2f(subv2f(b->ex.impulse, a->ex.impulse), m->normal);
+    c->bounce = contact_velocity < 0 ? -e * contact_velocity : 0;
+    const v2f t = _v2f(-m->normal.y, m->normal.x);
+    const v2f impulse = addv2f(mulv2nf(m->normal, c->normal_impulse), mulv2nf(t, c->tangent_impulse));
+    pf_contact_push(impulse, a, b);
+}
+
+// Like pf_apply_manifold, but clamps the total impulse of the contact
+// instead of each pass, so passes and steps can build on each other
+void pf_apply_contact(PfContact *c, PfBody *a, PfBody *b) {
+    const PfManifold *m = &c->manifold;
+    const float inverse_mass_sum = a->inverse_mass + b->inverse_mass;
+    if (nearzerof(inverse_mass_sum)) {
+        a->ex.impulse = _v2f(0,0);
+        b->ex.impulse = _v2f(0,0);
+        return;
+    }
+    v2f rv = subv2f(b->ex.impulse, a->ex.impulse);
+    const float j = (c->bounce - dotv2f(rv, m->normal)) / inverse_mass_sum;
+    const float normal_impulse = fmaxf(c->normal_impulse + j, 0);
+    pf_contact_push(mulv2nf(m->normal, normal_impulse - c->normal_impulse), a, b);
+    c->normal_impulse = normal_impulse;
+
+    rv = subv2f(b->ex.impulse, a->ex.impulse);
+    const v2f t = _v2f(-m->normal.y, m->normal.x);
+    const float jt = -dotv2f(rv, t) / inverse_mass_sum;
+    const float total = c->tangent_impulse + jt;
+    const float limit = normal_impulse * m->dynamic_friction;
+    const float tangent_impulse = fabsf(total) < normal_impulse * m->static_friction
+        ? total
+        : clampf(-limit, limit, total);
+    pf_contact_push(mulv2nf(t, tangent_impulse - c->tangent_impulse), a, b);
+    c->tangent_impulse = tangent_impulse;
+}
+
+void pf_body_wake(PfBody *a) {
+    a->asleep = false;
+    a->still = 0;
+}
+
 void pf_body_set_mass(float mass, PfBody *a) {
     a->mass = mass;
     a->inverse_mass = recipinff(mass);
@@ -1262,16 +1692,21 @@ v2f tri_normal(const v2f *radii, PfCorner hypotenuse) {
 
 PfTri _pf_tri(v2f radii, bool line, PfCorner hypotenuse) {
     const float radians = tri_angle(&radii, hypotenuse);
+#ifdef PF_DETERMINISTIC
+    const v2f sin_cos = tri_sin_cos(&radii, hypotenuse);
+#else
+    const v2f sin_cos = _v2f(sinf(radians), cosf(radians));
+#endif
     return (PfTri) {
         .radii = radii,
         .line = line,
         .hypotenuse = hypotenuse,
         .radians = radians,
         .m = pf_tri_slope(&radii, hypotenuse),
-        .proj = projection_vector(radians),
+        .proj = _v2f(sin_cos.y, -sin_cos.x),
         .normal = tri_normal(&radii, hypotenuse),
-        .sin = sinf(radians),
-        .cos = cosf(radians),
+        .sin = sin_cos.x,
+        .cos = sin_cos.y,
     };
 }
 
@@ -1281,21 +1716,23 @@ PfGroup _pf_platform() {
         .platform = (PfPlatform) {
             .allow = 0,
             .convey = _v2f(0,0),
-            .left = NULL,
-            .right = NULL,
+            .left = PF_NO_HANDLE,
+            .right = PF_NO_HANDLE,
         },
     };
 }
 
 PfBody _pf_body() {
     return (PfBody) {
+        .handle = PF_NO_HANDLE,
         .mode = PF_MODE_DYNAMIC,
         .shape = (PfShape) {
                 .tag = PF_SHAPE_CIRCLE,
                 .radius = 0
             },
         .pos = _v2f(0,0),
-        .group.object.parent = NULL,
+        .prev_pos = _v2f(0,0),
+        .group.object.parent = PF_NO_HANDLE,
         .group.object.check_parent = false,
         .dpos = _v2f(0,0),
         .in = { 
@@ -1319,6 +1756,11 @@ PfBody _pf_body() {
         .static_friction = 0.9,
         .dynamic_friction = 0.7,
         .restitution = 0.5,
+        .asleep = false,
+        .still = 0,
+        .ccd = false,
+        .category = 1,
+        .mask = ~0u,
     };
 }
 
@@ -1375,9 +1817,9 @@ v2f pf_move_right_on_slope_transform(const PfTri *t) {
     }
 }
 
-void pf_transform_move_on_slope(PfBody *a, float dt_) {
+void pf_transform_move_on_slope(const PfWorld *w, PfBody *a, float dt_) {
     const float dt = 2 * dt_; // Adjust for round off
-    const PfBody *b = a->group.object.parent;
+    const PfBody *b = pf_world_get(w, a->group.object.parent);
     if (!b ||
         b->shape.tag != PF_SHAPE_TRI ||
         a->shape.tag != PF_SHAPE_RECT ||
@@ -1415,10 +1857,10 @@ void pf_transform_move_on_slope(PfBody *a, float dt_) {
                     weight = 0;
                 }
                 // Move onto next platform
-                if (a->group.object.parent->group.platform.left) {
-                    a->group.object.parent = a->group.object.parent->group.platform.left;
-                    const PfBody *c = a->group.object.parent;
-                    if (c->shape.tag == PF_SHAPE_TRI) {
+                if (!pf_handle_none(b->group.platform.left)) {
+                    a->group.object.parent = b->group.platform.left;
+                    const PfBody *c = pf_world_get(w, a->group.object.parent);
+                    if (c && c->shape.tag == PF_SHAPE_TRI) {
                         pure = mulv2nf(pf_move_left_on_slope_transform(&c->shape.tri), force);
                     }
                 } else {
@@ -1437,10 +1879,10 @@ void pf_transform_move_on_slope(PfBody *a, float dt_) {
                     weight = 0;
                 }
                 // Move onto next platform
-                if (a->group.object.parent->group.platform.left) {
-                    a->group.object.parent = a->group.object.parent->group.platform.left;
-                    const PfBody *c = a->group.object.parent;
-                    if (c->shape.tag == PF_SHAPE_TRI) {
+                if (!pf_handle_none(b->group.platform.left)) {
+                    a->group.object.parent = b->group.platform.left;
+                    const PfBody *c = pf_world_get(w, a->group.object.parent);
+                    if (c && c->shape.tag == PF_SHAPE_TRI) {
                         pure = mulv2nf(pf_move_left_on_slope_transform(&c->shape.tri), force);
                     }
                 } else {
@@ -1473,10 +1915,10 @@ void pf_transform_move_on_slope(PfBody *a, float dt_) {
                     weight = 0;
                 }
                 // Move onto next slope
-                if (a->group.object.parent->group.platform.right) {
-                    a->group.object.parent = a->group.object.parent->group.platform.right;
-                    const PfBody *c = a->group.object.parent;
-                    if (c->shape.tag == PF_SHAPE_TRI) {
+                if (!pf_handle_none(b->group.platform.right)) {
+                    a->group.object.parent = b->group.platform.right;
+                    const PfBody *c = pf_world_get(w, a->group.object.parent);
+                    if (c && c->shape.tag == PF_SHAPE_TRI) {
                         pure = mulv2nf(pf_move_right_on_slope_transform(&c->shape.tri), force);
                     }
                 } else {
@@ -1495,10 +1937,10 @@ void pf_transform_move_on_slope(PfBody *a, float dt_) {
                     weight = 0;
                 }
                 // Move onto next slope
-                if (a->group.object.parent->group.platform.right) {
-                    a->group.object.parent = a->group.object.parent->group.platform.right;
-                    const PfBody *c = a->group.object.parent;
-                    if (c->shape.tag == PF_SHAPE_TRI) {
+                if (!pf_handle_none(b->group.platform.right)) {
+                    a->group.object.parent = b->group.platform.right;
+                    const PfBody *c = pf_world_get(w, a->group.object.parent);
+                    if (c && c->shape.tag == PF_SHAPE_TRI) {
                         pure = mulv2nf(pf_move_right_on_slope_transform(&c->shape.tri), force);
                     }
                 } else {
@@ -1516,3 +1958,2864 @@ void pf_transform_move_on_slope(PfBody *a, float dt_) {
         a->in.impulse = addv2f(mulv2nf(slope, weight), mulv2nf(pure, 1.0f - weight));
     }
 }
+
+bool pf_v2f_array_init(PfV2fArray *a, int cap) {
+    a->x = calloc(cap, sizeof(float));
+    a->y = calloc(cap, sizeof(float));
+    return a->x && a->y;
+}
+
+void pf_v2f_array_free(PfV2fArray *a) {
+    free(a->x);
+    free(a->y);
+    a->x = NULL;
+    a->y = NULL;
+}
+
+void pf_v2f_array_set(PfV2fArray *a, int i, v2f v) {
+    a->x[i] = v.x;
+    a->y[i] = v.y;
+}
+
+v2f pf_v2f_array_get(const PfV2fArray *a, int i) {
+    return _v2f(a->x[i], a->y[i]);
+}
+
+// Slots start at rest, so slots of no body integrate to nothing
+bool pf_store_init(PfBodyStore *s, int cap) {
+    *s = (PfBodyStore) {
+        .num = 0,
+        .cap = cap,
+        .gravity_accel = calloc(cap, sizeof(float)),
+        .gravity_cap = calloc(cap, sizeof(float)),
+        .gravity_vel = calloc(cap, sizeof(float)),
+        .inverse_mass = calloc(cap, sizeof(float)),
+        .massive = calloc(cap, sizeof(int)),
+        .attached = calloc(cap, sizeof(int)),
+        .moving = calloc(cap, sizeof(bool)),
+    };
+    bool ok =
+        s->gravity_accel && s->gravity_cap && s->gravity_vel &&
+        s->inverse_mass && s->massive && s->attached && s->moving;
+    ok = pf_v2f_array_init(&s->pos, cap) && ok;
+    ok = pf_v2f_array_init(&s->dpos, cap) && ok;
+    ok = pf_v2f_array_init(&s->in_impulse, cap) && ok;
+    ok = pf_v2f_array_init(&s->ex_impulse, cap) && ok;
+    ok = pf_v2f_array_init(&s->in_decay, cap) && ok;
+    ok = pf_v2f_array_init(&s->ex_decay, cap) && ok;
+    ok = pf_v2f_array_init(&s->in_min, cap) && ok;
+    ok = pf_v2f_array_init(&s->in_max, cap) && ok;
+    ok = pf_v2f_array_init(&s->ex_min, cap) && ok;
+    ok = pf_v2f_array_init(&s->ex_max, cap) && ok;
+    ok = pf_v2f_array_init(&s->gravity, cap) && ok;
+    if (!ok) {
+        pf_store_free(s);
+    }
+    return ok;
+}
+
+void pf_store_free(PfBodyStore *s) {
+    pf_v2f_array_free(&s->pos);
+    pf_v2f_array_free(&s->dpos);
+    pf_v2f_array_free(&s->in_impulse);
+    pf_v2f_array_free(&s->ex_impulse);
+    pf_v2f_array_free(&s->in_decay);
+    pf_v2f_array_free(&s->ex_decay);
+    pf_v2f_array_free(&s->in_min);
+    pf_v2f_array_free(&s->in_max);
+    pf_v2f_array_free(&s->ex_min);
+    pf_v2f_array_free(&s->ex_max);
+    pf_v2f_array_free(&s->gravity);
+    free(s->gravity_accel);
+    free(s->gravity_cap);
+    free(s->gravity_vel);
+    free(s->inverse_mass);
+    free(s->massive);
+    free(s->attached);
+    free(s->moving);
+    s->gravity_accel = NULL;
+    s->gravity_cap = NULL;
+    s->gravity_vel = NULL;
+    s->inverse_mass = NULL;
+    s->massive = NULL;
+    s->attached = NULL;
+    s->moving = NULL;
+    s->num = 0;
+    s->cap = 0;
+}
+
+// Stops integrating key, its settings are loaded again once it moves
+void pf_store_rest(PfBodyStore *s, int key) {
+    pf_v2f_array_set(&s->in_impulse, key, _v2f(0, 0));
+    pf_v2f_array_set(&s->ex_impulse, key, _v2f(0, 0));
+    s->gravity_vel[key] = 0;
+    s->massive[key] = 0;
+    s->moving[key] = false;
+}
+
+// Reads the settings of a, which only change when the host changes them
+void pf_store_load(PfBodyStore *s, int key, const PfBody *a) {
+    pf_v2f_array_set(&s->in_decay, key, a->in.decay);
+    pf_v2f_array_set(&s->ex_decay, key, a->ex.decay);
+    pf_v2f_array_set(&s->in_min, key, sigv2f(a->in.cap));
+    pf_v2f_array_set(&s->in_max, key, absv2f(a->in.cap));
+    pf_v2f_array_set(&s->ex_min, key, sigv2f(a->ex.cap));
+    pf_v2f_array_set(&s->ex_max, key, absv2f(a->ex.cap));
+    pf_v2f_array_set(&s->gravity, key, pf_gravity_v2f(a->gravity.dir, 1));
+    s->gravity_accel[key] = a->gravity.accel;
+    s->gravity_cap[key] = a->gravity.cap;
+    s->inverse_mass[key] = a->inverse_mass;
+    s->massive[key] = nearzerof(a->inverse_mass) ? 0 : -1;
+    s->moving[key] = true;
+}
+
+// Reads what the rest of the step and the host write between integrations
+void pf_store_pull(PfBodyStore *s, int key, const PfBody *a) {
+    pf_v2f_array_set(&s->pos, key, a->pos);
+    pf_v2f_array_set(&s->in_impulse, key, a->in.impulse);
+    pf_v2f_array_set(&s->ex_impulse, key, a->ex.impulse);
+    s->gravity_vel[key] = a->gravity.vel;
+    s->attached[key] = pf_handle_none(a->group.object.parent) ? 0 : -1;
+}
+
+// Writes back what integration changes
+void pf_store_push(const PfBodyStore *s, int key, PfBody *a) {
+    a->pos = pf_v2f_array_get(&s->pos, key);
+    a->dpos = pf_v2f_array_get(&s->dpos, key);
+    a->in.impulse = pf_v2f_array_get(&s->in_impulse, key);
+    a->ex.impulse = pf_v2f_array_get(&s->ex_impulse, key);
+    a->gravity.vel = s->gravity_vel[key];
+}
+
+/*
+ * The store kernels, vector and scalar, do the same operations in the same
+ * order as pf_update_dpos and pf_step_forces, so results match them bit for
+ * bit as long as clampf(lo, hi, v) picks lo or hi the way min/max does (no
+ * NaNs, lo <= hi). The vector loops cover whole blocks of lanes and the
+ * scalar ones the tail.
+ */
+void pf_store_update_dpos_at(float dt, PfBodyStore *s, int i) {
+    s->in_impulse.x[i] = clampf(s->in_min.x[i], s->in_max.x[i], s->in_impulse.x[i]);
+    s->in_impulse.y[i] = clampf(s->in_min.y[i], s->in_max.y[i], s->in_impulse.y[i]);
+    if (s->massive[i]) {
+        s->ex_impulse.x[i] = clampf(s->ex_min.x[i], s->ex_max.x[i], s->ex_impulse.x[i]);
+        s->ex_impulse.y[i] = clampf(s->ex_min.y[i], s->ex_max.y[i], s->ex_impulse.y[i]);
+        const float vel = clampf(-s->gravity_cap[i], s->gravity_cap[i], s->gravity_vel[i]);
+        s->gravity_vel[i] = vel;
+        s->dpos.x[i] = s->in_impulse.x[i] * dt;
+        s->dpos.y[i] = s->in_impulse.y[i] * dt;
+        s->dpos.x[i] = s->dpos.x[i] + s->ex_impulse.x[i] * dt;
+        s->dpos.y[i] = s->dpos.y[i] + s->ex_impulse.y[i] * dt;
+        if (!s->attached[i]) {
+            s->dpos.x[i] = s->dpos.x[i] + (s->gravity.x[i] != 0 ? s->gravity.x[i] * vel : 0);
+            s->dpos.y[i] = s->dpos.y[i] + (s->gravity.y[i] != 0 ? s->gravity.y[i] * vel : 0);
+        }
+    } else {
+        s->dpos.x[i] = s->in_impulse.x[i] * dt;
+        s->dpos.y[i] = s->in_impulse.y[i] * dt;
+    }
+}
+
+#if PF_LANES > 1
+void pf_lane_clamp(float *v, const float *lo, const float *hi, int i, PfLane keep) {
+    const PfLane x = pf_lane_load(v + i);
+    const PfLane c = pf_lane_min(pf_lane_max(x, pf_lane_load(lo + i)), pf_lane_load(hi + i));
+    pf_lane_store(v + i, pf_lane_select(keep, c, x));
+}
+
+void pf_lane_dpos(float *dpos, const float *in, const float *ex, const float *g,
+                  PfLane vel, PfLane dt, PfLane massive, PfLane attached, int i) {
+    const PfLane pure = pf_lane_mul(pf_lane_load(in + i), dt);
+    const PfLane mixed = pf_lane_add(pure, pf_lane_mul(pf_lane_load(ex + i), dt));
+    const PfLane gv = pf_lane_load(g + i);
+    const PfLane fall = pf_lane_select(pf_lane_nonzero(gv), pf_lane_mul(gv, vel), pf_lane_fill(0));
+    const PfLane full = pf_lane_select(attached, mixed, pf_lane_add(mixed, fall));
+    pf_lane_store(dpos + i, pf_lane_select(massive, full, pure));
+}
+#endif
+
+// Same as pf_update_dpos over every slot
+void pf_store_update_dpos(float dt, PfBodyStore *s) {
+    int i = 0;
+#if PF_LANES > 1
+    const PfLane all = pf_lane_nonzero(pf_lane_fill(1));
+    const PfLane sign = pf_lane_fill(-0.0f);
+    const PfLane dtv = pf_lane_fill(dt);
+    for (; i + PF_LANES <= s->num; i += PF_LANES) {
+        const PfLane massive = pf_lane_mask(s->massive + i);
+        const PfLane attached = pf_lane_mask(s->attached + i);
+        pf_lane_clamp(s->in_impulse.x, s->in_min.x, s->in_max.x, i, all);
+        pf_lane_clamp(s->in_impulse.y, s->in_min.y, s->in_max.y, i, all);
+        pf_lane_clamp(s->ex_impulse.x, s->ex_min.x, s->ex_max.x, i, massive);
+        pf_lane_clamp(s->ex_impulse.y, s->ex_min.y, s->ex_max.y, i, massive);
+        const PfLane cap = pf_lane_load(s->gravity_cap + i);
+        const PfLane vel = pf_lane_load(s->gravity_vel + i);
+        const PfLane clamped = pf_lane_min(pf_lane_max(vel, pf_lane_xor(cap, sign)), cap);
+        const PfLane v = pf_lane_select(massive, clamped, vel);
+        pf_lane_store(s->gravity_vel + i, v);
+        pf_lane_dpos(s->dpos.x, s->in_impulse.x, s->ex_impulse.x, s->gravity.x, v, dtv, massive, attached, i);
+        pf_lane_dpos(s->dpos.y, s->in_impulse.y, s->ex_impulse.y, s->gravity.y, v, dtv, massive, attached, i);
+    }
+#endif
+    for (; i < s->num; i++) {
+        pf_store_update_dpos_at(dt, s, i);
+    }
+}
+
+void pf_store_apply_dpos(PfBodyStore *s) {
+    int i = 0;
+#if PF_LANES > 1
+    for (; i + PF_LANES <= s->num; i += PF_LANES) {
+        pf_lane_store(s->pos.x + i, pf_lane_add(pf_lane_load(s->pos.x + i), pf_lane_load(s->dpos.x + i)));
+        pf_lane_store(s->pos.y + i, pf_lane_add(pf_lane_load(s->pos.y + i), pf_lane_load(s->dpos.y + i)));
+    }
+#endif
+    for (; i < s->num; i++) {
+        s->pos.x[i] = s->pos.x[i] + s->dpos.x[i];
+        s->pos.y[i] = s->pos.y[i] + s->dpos.y[i];
+    }
+}
+
+void pf_store_step_forces_at(float dt, PfBodyStore *s, int i) {
+    s->in_impulse.x[i] = s->in_impulse.x[i] * s->in_decay.x[i];
+    s->in_impulse.y[i] = s->in_impulse.y[i] * s->in_decay.y[i];
+    if (s->massive[i]) {
+        s->ex_impulse.x[i] = s->ex_impulse.x[i] * s->ex_decay.x[i];
+        s->ex_impulse.y[i] = s->ex_impulse.y[i] * s->ex_decay.y[i];
+        s->gravity_vel[i] = s->attached[i] ? 0 : s->gravity_vel[i] + (s->gravity_accel[i] * dt / 2);
+    } else {
+        s->ex_impulse.x[i] = 0;
+        s->ex_impulse.y[i] = 0;
+        s->gravity_vel[i] = 0;
+    }
+}
+
+// Same as pf_step_forces over every slot
+void pf_store_step_forces(float dt, PfBodyStore *s) {
+    int i = 0;
+#if PF_LANES > 1
+    const PfLane zero = pf_lane_fill(0);
+    const PfLane dtv = pf_lane_fill(dt);
+    const PfLane half = pf_lane_fill(0.5f);
+    for (; i + PF_LANES <= s->num; i += PF_LANES) {
+        const PfLane massive = pf_lane_mask(s->massive + i);
+        const PfLane attached = pf_lane_mask(s->attached + i);
+        pf_lane_store(s->in_impulse.x + i, pf_lane_mul(pf_lane_load(s->in_impulse.x + i), pf_lane_load(s->in_decay.x + i)));
+        pf_lane_store(s->in_impulse.y + i, pf_lane_mul(pf_lane_load(s->in_impulse.y + i), pf_lane_load(s->in_decay.y + i)));
+        const PfLane ex_x = pf_lane_mul(pf_lane_load(s->ex_impulse.x + i), pf_lane_load(s->ex_decay.x + i));
+        const PfLane ex_y = pf_lane_mul(pf_lane_load(s->ex_impulse.y + i), pf_lane_load(s->ex_decay.y + i));
+        pf_lane_store(s->ex_impulse.x + i, pf_lane_select(massive, ex_x, zero));
+        pf_lane_store(s->ex_impulse.y + i, pf_lane_select(massive, ex_y, zero));
+        // x / 2 and x * 0.5 round the same
+        const PfLane fall = pf_lane_mul(pf_lane_mul(pf_lane_load(s->gravity_accel + i), dtv), half);
+        const PfLane vel = pf_lane_select(attached, zero, pf_lane_add(pf_lane_load(s->gravity_vel + i), fall));
+        pf_lane_store(s->gravity_vel + i, pf_lane_select(massive, vel, zero));
+    }
+#endif
+    for (; i < s->num; i++) {
+        pf_store_step_forces_at(dt, s, i);
+    }
+}
+
+bool pf_pair_list_push(PfPairList *l, int a, int b) {
+    if (l->num == l->cap) {
+        const int cap = l->cap ? l->cap * 2 : 256;
+        PfPair *pairs = realloc(l->pairs, sizeof(PfPair) * cap);
+        if (!pairs) {
+            return false;
+        }
+        l->pairs = pairs;
+        l->cap = cap;
+    }
+    l->pairs[l->num] = (PfPair) { .a = a, .b = b };
+    l->num++;
+    return true;
+}
+
+int pf_pair_cmp(const void *x, const void *y) {
+    const PfPair *p = x;
+    const PfPair *q = y;
+    if (p->a != q->a) {
+        return p->a < q->a ? -1 : 1;
+    }
+    return p->b < q->b ? -1 : (p->b > q->b);
+}
+
+// Same order as testing every i < j pair
+void pf_pair_list_sort(PfPairList *l) {
+    qsort(l->pairs, l->num, sizeof(PfPair), pf_pair_cmp);
+}
+
+void pf_pair_list_free(PfPairList *l) {
+    free(l->pairs);
+    *l = (PfPairList) { .pairs = NULL, .num = 0, .cap = 0 };
+}
+
+bool pf_grid_init(PfGrid *g, float cell_size, int proxy_cap) {
+    int bucket_num = 64;
+    while (bucket_num < proxy_cap * 2) {
+        bucket_num *= 2;
+    }
+    g->cell_size = cell_size;
+    g->buckets = malloc(sizeof(int) * bucket_num);
+    g->bucket_mask = bucket_num - 1;
+    g->entries = NULL;
+    g->entry_cap = 0;
+    g->free_entry = -1;
+    g->proxies = malloc(sizeof(PfGridProxy) * proxy_cap);
+    g->proxy_num = 0;
+    g->proxy_cap = proxy_cap;
+    if (!g->buckets || !g->proxies) {
+        pf_grid_free(g);
+        return false;
+    }
+    for (int i = 0; i < bucket_num; i++) {
+        g->buckets[i] = -1;
+    }
+    for (int i = 0; i < proxy_cap; i++) {
+        g->proxies[i].first = -1;
+    }
+    return true;
+}
+
+void pf_grid_free(PfGrid *g) {
+    free(g->buckets);
+    free(g->entries);
+    free(g->proxies);
+    g->buckets = NULL;
+    g->entries = NULL;
+    g->proxies = NULL;
+    g->entry_cap = 0;
+    g->proxy_num = 0;
+    g->proxy_cap = 0;
+}
+
+int pf_grid_cell(const PfGrid *g, float x) {
+    return (int)floorf(x / g->cell_size);
+}
+
+int pf_grid_bucket(const PfGrid *g, int cx, int cy) {
+    const unsigned int h = ((unsigned int)cx * 73856093u) ^ ((unsigned int)cy * 19349663u);
+    return h & g->bucket_mask;
+}
+
+int pf_grid_alloc_entry(PfGrid *g) {
+    if (g->free_entry == -1) {
+        const int cap = g->entry_cap ? g->entry_cap * 2 : 1024;
+        PfGridEntry *entries = realloc(g->entries, sizeof(PfGridEntry) * cap);
+        if (!entries) {
+            return -1;
+        }
+        for (int i = g->entry_cap; i < cap; i++) {
+            entries[i].next = i + 1 < cap ? i + 1 : -1;
+        }
+        g->free_entry = g->entry_cap;
+        g->entries = entries;
+        g->entry_cap = cap;
+    }
+    const int e = g->free_entry;
+    g->free_entry = g->entries[e].next;
+    return e;
+}
+
+void pf_grid_remove(PfGrid *g, int key) {
+    PfGridProxy *p = &g->proxies[key];
+    int e = p->first;
+    while (e != -1) {
+        PfGridEntry *entry = &g->entries[e];
+        const int sibling = entry->sibling;
+        if (entry->prev != -1) {
+            g->entries[entry->prev].next = entry->next;
+        } else {
+            g->buckets[pf_grid_bucket(g, entry->cx, entry->cy)] = entry->next;
+        }
+        if (entry->next != -1) {
+            g->entries[entry->next].prev = entry->prev;
+        }
+        entry->next = g->free_entry;
+        g->free_entry = e;
+        e = sibling;
+    }
+    p->first = -1;
+}
+
+// Only relinks the proxy when it crosses into different cells
+bool pf_grid_update(PfGrid *g, int key, const PfAabb *aabb, bool fixed, unsigned category, unsigned mask) {
+    assert(key >= 0 && key < g->proxy_cap);
+    PfGridProxy *p = &g->proxies[key];
+    const int min_x = pf_grid_cell(g, aabb->min.x);
+    const int min_y = pf_grid_cell(g, aabb->min.y);
+    const int max_x = pf_grid_cell(g, aabb->max.x);
+    const int max_y = pf_grid_cell(g, aabb->max.y);
+    p->aabb = *aabb;
+    p->fixed = fixed;
+    p->category = category;
+    p->mask = mask;
+    if (key >= g->proxy_num) {
+        g->proxy_num = key + 1;
+    }
+    if (p->first != -1 &&
+        p->min_x == min_x && p->min_y == min_y &&
+        p->max_x == max_x && p->max_y == max_y) {
+        return true;
+    }
+    pf_grid_remove(g, key);
+    p->min_x = min_x;
+    p->min_y = min_y;
+    p->max_x = max_x;
+    p->max_y = max_y;
+    for (int cy = min_y; cy <= max_y; cy++) {
+        for (int cx = min_x; cx <= max_x; cx++) {
+            const int e = pf_grid_alloc_entry(g);
+            if (e == -1) {
+                return false;
+            }
+            const int bucket = pf_grid_bucket(g, cx, cy);
+            PfGridEntry *entry = &g->entries[e];
+            entry->key = key;
+            entry->cx = cx;
+            entry->cy = cy;
+            entry->prev = -1;
+            entry->next = g->buckets[bucket];
+            entry->sibling = p->first;
+            if (entry->next != -1) {
+                g->entries[entry->next].prev = e;
+            }
+            g->buckets[bucket] = e;
+            p->first = e;
+        }
+    }
+    return true;
+}
+
+// Appends each overlapping pair once as (lower key, higher key)
+bool pf_grid_find_pairs(const PfGrid *g, PfPairList *out) {
+    for (int i = 0; i < g->proxy_num; i++) {
+        const PfGridProxy *p = &g->proxies[i];
+        if (p->first == -1 || p->fixed) {
+            continue;
+        }
+        for (int cy = p->min_y; cy <= p->max_y; cy++) {
+            for (int cx = p->min_x; cx <= p->max_x; cx++) {
+                int e = g->buckets[pf_grid_bucket(g, cx, cy)];
+                for (; e != -1; e = g->entries[e].next) {
+                    const PfGridEntry *entry = &g->entries[e];
+                    const int j = entry->key;
+                    if (j == i || entry->cx != cx || entry->cy != cy) {
+                        continue;
+                    }
+                    const PfGridProxy *q = &g->proxies[j];
+                    // Moving pairs are found from both sides, keep one
+                    if (!q->fixed && j < i) {
+                        continue;
+                    }
+                    // Only report from the first cell both share
+                    if (cx != (p->min_x > q->min_x ? p->min_x : q->min_x) ||
+                        cy != (p->min_y > q->min_y ? p->min_y : q->min_y)) {
+                        continue;
+                    }
+                    if (!pf_layer_bits_meet(p->category, p->mask, q->category, q->mask) ||
+                        !pf_intersect(&p->aabb, &q->aabb)) {
+                        continue;
+                    }
+                    if (!pf_pair_list_push(out, i < j ? i : j, i < j ? j : i)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool pf_sap_init(PfSap *s, int proxy_cap) {
+    *s = (PfSap) {
+        .endpoints = malloc(sizeof(PfSapEndpoint) * proxy_cap * 2),
+        .endpoint_num = 0,
+        .proxies = malloc(sizeof(PfSapProxy) * proxy_cap),
+        .proxy_cap = proxy_cap,
+        .sweep = malloc(sizeof(int) * proxy_cap),
+    };
+    if (!s->endpoints || !s->proxies || !s->sweep) {
+        pf_sap_free(s);
+        return false;
+    }
+    for (int i = 0; i < proxy_cap; i++) {
+        s->proxies[i].active = false;
+    }
+    return true;
+}
+
+void pf_sap_free(PfSap *s) {
+    free(s->endpoints);
+    free(s->proxies);
+    free(s->sweep);
+    pf_pair_list_free(&s->pairs);
+    pf_pair_list_free(&s->last);
+    pf_pair_list_free(&s->added);
+    pf_pair_list_free(&s->removed);
+    *s = (PfSap) { .endpoints = NULL, .proxies = NULL, .sweep = NULL };
+}
+
+// New proxies are appended and sorted into place by the next find
+void pf_sap_update(PfSap *s, int key, const PfAabb *aabb, bool fixed, unsigned category, unsigned mask) {
+    assert(key >= 0 && key < s->proxy_cap);
+    PfSapProxy *p = &s->proxies[key];
+    p->aabb = *aabb;
+    p->fixed = fixed;
+    p->category = category;
+    p->mask = mask;
+    if (!p->active) {
+        p->active = true;
+        s->endpoints[s->endpoint_num++] = (PfSapEndpoint) { .value = aabb->min.x, .key = key, .max = false };
+        s->endpoints[s->endpoint_num++] = (PfSapEndpoint) { .value = aabb->max.x, .key = key, .max = true };
+    }
+}
+
+void pf_sap_remove(PfSap *s, int key) {
+    if (!s->proxies[key].active) {
+        return;
+    }
+    s->proxies[key].active = false;
+    int n = 0;
+    for (int i = 0; i < s->endpoint_num; i++) {
+        if (s->endpoints[i].key != key) {
+            s->endpoints[n++] = s->endpoints[i];
+        }
+    }
+    s->endpoint_num = n;
+}
+
+bool pf_sap_before(const PfSapEndpoint *a, const PfSapEndpoint *b) {
+    return a->value < b->value || (a->value == b->value && !a->max && b->max);
+}
+
+// Nearly sorted from the last update, so insertion sort is close to linear
+void pf_sap_sort(PfSap *s) {
+    PfSapEndpoint *e = s->endpoints;
+    for (int i = 0; i < s->endpoint_num; i++) {
+        const PfAabb *box = &s->proxies[e[i].key].aabb;
+        e[i].value = e[i].max ? box->max.x : box->min.x;
+    }
+    for (int i = 1; i < s->endpoint_num; i++) {
+        const PfSapEndpoint x = e[i];
+        int j = i - 1;
+        while (j >= 0 && pf_sap_before(&x, &e[j])) {
+            e[j + 1] = e[j];
+            j--;
+        }
+        e[j + 1] = x;
+    }
+}
+
+// Walks both sorted lists, sorting pairs into added or removed
+bool pf_sap_diff(PfSap *s) {
+    const PfPair *now = s->pairs.pairs;
+    const PfPair *was = s->last.pairs;
+    int i = 0;
+    int j = 0;
+    s->added.num = 0;
+    s->removed.num = 0;
+    while (i < s->pairs.num || j < s->last.num) {
+        const int cmp = i == s->pairs.num ? 1
+            : j == s->last.num ? -1
+            : pf_pair_cmp(&now[i], &was[j]);
+        if (cmp < 0) {
+            if (!pf_pair_list_push(&s->added, now[i].a, now[i].b)) {
+                return false;
+            }
+            i++;
+        } else if (cmp > 0) {
+            if (!pf_pair_list_push(&s->removed, was[j].a, was[j].b)) {
+                return false;
+            }
+            j++;
+        } else {
+            i++;
+            j++;
+        }
+    }
+    return true;
+}
+
+// Fills pairs with every overlapping pair
+bool pf_sap_find_pairs(PfSap *s) {
+    s->pairs.num = 0;
+
+    pf_sap_sort(s);
+
+    int open = 0;
+    for (int i = 0; i < s->endpoint_num; i++) {
+        const PfSapEndpoint *e = &s->endpoints[i];
+        if (e->max) {
+            for (int k = 0; k < open; k++) {
+                if (s->sweep[k] == e->key) {
+                    s->sweep[k] = s->sweep[--open];
+                    break;
+                }
+            }
+            continue;
+        }
+        const PfSapProxy *p = &s->proxies[e->key];
+        for (int k = 0; k < open; k++) {
+            const int j = s->sweep[k];
+            const PfSapProxy *q = &s->proxies[j];
+            if ((p->fixed && q->fixed) ||
+                !pf_layer_bits_meet(p->category, p->mask, q->category, q->mask) ||
+                !pf_intersect(&p->aabb, &q->aabb)) {
+                continue;
+            }
+            if (!pf_pair_list_push(&s->pairs, e->key < j ? e->key : j, e->key < j ? j : e->key)) {
+                return false;
+            }
+        }
+        s->sweep[open++] = e->key;
+    }
+    pf_pair_list_sort(&s->pairs);
+    return true;
+}
+
+// Fills added and removed with what changed since the last report. Finds run
+// twice a step, so the world reports once, after the last of them.
+bool pf_sap_report(PfSap *s) {
+    if (!pf_sap_diff(s)) {
+        return false;
+    }
+    s->last.num = 0;
+    for (int i = 0; i < s->pairs.num; i++) {
+        if (!pf_pair_list_push(&s->last, s->pairs.pairs[i].a, s->pairs.pairs[i].b)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    int key;
+    PfAabb aabb;
+    v2f center;
+    unsigned category;
+    unsigned mask;
+} PfBvhItem;
+
+int pf_bvh_cmp_x(const void *x, const void *y) {
+    const PfBvhItem *p = x;
+    const PfBvhItem *q = y;
+    return p->center.x < q->center.x ? -1 : (p->center.x > q->center.x);
+}
+
+int pf_bvh_cmp_y(const void *x, const void *y) {
+    const PfBvhItem *p = x;
+    const PfBvhItem *q = y;
+    return p->center.y < q->center.y ? -1 : (p->center.y > q->center.y);
+}
+
+PfAabb pf_aabb_union(const PfAabb *a, const PfAabb *b) {
+    return (PfAabb) {
+        .min = _v2f(fminf(a->min.x, b->min.x), fminf(a->min.y, b->min.y)),
+        .max = _v2f(fmaxf(a->max.x, b->max.x), fmaxf(a->max.y, b->max.y)),
+    };
+}
+
+// Splits at the median of the axis the centers spread most along
+int pf_bvh_build_node(PfBvh *t, PfBvhItem *items, int n, int parent) {
+    const int node = t->node_num++;
+    PfBvhNode *nd = &t->nodes[node];
+    nd->parent = parent;
+    if (n == 1) {
+        nd->aabb = items[0].aabb;
+        nd->left = -1;
+        nd->right = -1;
+        nd->key = items[0].key;
+        nd->category = items[0].category;
+        nd->mask = items[0].mask;
+        t->leaves[items[0].key] = node;
+        return node;
+    }
+    PfAabb spread = { .min = items[0].center, .max = items[0].center };
+    for (int i = 1; i < n; i++) {
+        const PfAabb c = { .min = items[i].center, .max = items[i].center };
+        spread = pf_aabb_union(&spread, &c);
+    }
+    const v2f size = subv2f(spread.max, spread.min);
+    qsort(items, n, sizeof(PfBvhItem), size.x >= size.y ? pf_bvh_cmp_x : pf_bvh_cmp_y);
+    const int left = pf_bvh_build_node(t, items, n / 2, node);
+    const int right = pf_bvh_build_node(t, items + n / 2, n - n / 2, node);
+    nd = &t->nodes[node];
+    nd->left = left;
+    nd->right = right;
+    nd->key = -1;
+    nd->aabb = pf_aabb_union(&t->nodes[left].aabb, &t->nodes[right].aabb);
+    // Meets a layer if any leaf under it does, so queries can skip whole subtrees
+    nd->category = t->nodes[left].category | t->nodes[right].category;
+    nd->mask = t->nodes[left].mask | t->nodes[right].mask;
+    return node;
+}
+
+bool pf_bvh_build(PfBvh *t, const int *keys, const PfAabb *boxes, const unsigned *categories, const unsigned *masks, int n, int key_cap) {
+    *t = (PfBvh) {
+        .nodes = malloc(sizeof(PfBvhNode) * (n > 0 ? 2 * n - 1 : 1)),
+        .node_num = 0,
+        .root = -1,
+        .leaves = malloc(sizeof(int) * key_cap),
+        .key_cap = key_cap,
+    };
+    PfBvhItem *items = malloc(sizeof(PfBvhItem) * (n > 0 ? n : 1));
+    if (!t->nodes || !t->leaves || !items) {
+        free(items);
+        pf_bvh_free(t);
+        return false;
+    }
+    for (int i = 0; i < key_cap; i++) {
+        t->leaves[i] = -1;
+    }
+    for (int i = 0; i < n; i++) {
+        items[i] = (PfBvhItem) {
+            .key = keys[i],
+            .aabb = boxes[i],
+            .center = pf_aabb_pos(&boxes[i]),
+            .category = categories[i],
+            .mask = masks[i],
+        };
+    }
+    if (n > 0) {
+        t->root = pf_bvh_build_node(t, items, n, -1);
+    }
+    free(items);
+    return true;
+}
+
+void pf_bvh_free(PfBvh *t) {
+    free(t->nodes);
+    free(t->leaves);
+    *t = (PfBvh) { .nodes = NULL, .node_num = 0, .root = -1, .leaves = NULL, .key_cap = 0 };
+}
+
+// The leaf of body from now belongs to body to, which had none
+void pf_bvh_rekey(PfBvh *t, int from, int to) {
+    const int node = t->leaves[from];
+    t->leaves[to] = node;
+    t->leaves[from] = -1;
+    t->nodes[node].key = to;
+}
+
+// For the odd static body that moves, the tree shape is kept as is
+void pf_bvh_refit(PfBvh *t, int key, const PfAabb *aabb) {
+    int node = t->leaves[key];
+    if (node == -1) {
+        return;
+    }
+    t->nodes[node].aabb = *aabb;
+    for (node = t->nodes[node].parent; node != -1; node = t->nodes[node].parent) {
+        PfBvhNode *nd = &t->nodes[node];
+        nd->aabb = pf_aabb_union(&t->nodes[nd->left].aabb, &t->nodes[nd->right].aabb);
+    }
+}
+
+// Appends (key, hit) for every leaf overlapping box whose layers meet category and mask
+bool pf_bvh_query(const PfBvh *t, const PfAabb *box, int key, unsigned category, unsigned mask, PfPairList *out) {
+    int stack[PF_BVH_STACK];
+    int top = 0;
+    if (t->root != -1) {
+        stack[top++] = t->root;
+    }
+    while (top > 0) {
+        const PfBvhNode *nd = &t->nodes[stack[--top]];
+        if (!pf_layer_bits_meet(category, mask, nd->category, nd->mask) || !pf_intersect(box, &nd->aabb)) {
+            continue;
+        }
+        if (nd->key != -1) {
+            if (!pf_pair_list_push(out, key, nd->key)) {
+                return false;
+            }
+        } else {
+            stack[top++] = nd->right;
+            stack[top++] = nd->left;
+        }
+    }
+    return true;
+}
+
+// Writes the key of every leaf overlapping box to out, returns how many
+int pf_bvh_collect(const PfBvh *t, const PfAabb *box, int *out) {
+    int stack[PF_BVH_STACK];
+    int top = 0;
+    int n = 0;
+    if (t->root != -1) {
+        stack[top++] = t->root;
+    }
+    while (top > 0) {
+        const PfBvhNode *nd = &t->nodes[stack[--top]];
+        if (!pf_intersect(box, &nd->aabb)) {
+            continue;
+        }
+        if (nd->key != -1) {
+            out[n++] = nd->key;
+        } else {
+            stack[top++] = nd->right;
+            stack[top++] = nd->left;
+        }
+    }
+    return n;
+}
+
+double pf_now_us() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+// Any thread may record, the ring slot is claimed atomically
+void pf_trace_push(PfTrace *t, const char *name, double begin_us, double end_us) {
+    if (t->cap == 0) {
+        return;
+    }
+    const unsigned n = __atomic_fetch_add(&t->next, 1, __ATOMIC_RELAXED);
+    t->events[n % t->cap] = (PfTraceEvent) {
+        .name = name,
+        .thread = (unsigned long)pthread_self(),
+        .begin_us = begin_us,
+        .end_us = end_us,
+    };
+}
+
+void* pf_pool_work(void *data) {
+    PfPool *p = data;
+    unsigned seen = 0;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->quit && p->batch == seen) {
+            pthread_cond_wait(&p->start, &p->lock);
+        }
+        if (p->quit) {
+            break;
+        }
+        seen = p->batch;
+        while (p->next_job < p->job_num) {
+            const int index = p->next_job++;
+            pthread_mutex_unlock(&p->lock);
+            p->job(p->arg, index);
+            pthread_mutex_lock(&p->lock);
+        }
+        if (--p->busy == 0) {
+            pthread_cond_signal(&p->finish);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Zero workers runs every job on the caller
+bool pf_pool_init(PfPool *p, int thread_num) {
+    *p = (PfPool) {
+        .threads = NULL,
+        .thread_num = 0,
+        .job = NULL,
+        .arg = NULL,
+        .job_num = 0,
+        .next_job = 0,
+        .busy = 0,
+        .batch = 0,
+        .quit = false,
+    };
+    if (thread_num <= 0) {
+        return true;
+    }
+    p->threads = malloc(sizeof(pthread_t) * thread_num);
+    if (!p->threads) {
+        return false;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->finish, NULL);
+    for (int i = 0; i < thread_num; i++) {
+        if (pthread_create(&p->threads[i], NULL, pf_pool_work, p) != 0) {
+            pf_pool_free(p);
+            return false;
+        }
+        p->thread_num++;
+    }
+    return true;
+}
+
+void pf_pool_free(PfPool *p) {
+    if (p->threads) {
+        pthread_mutex_lock(&p->lock);
+        p->quit = true;
+        pthread_cond_broadcast(&p->start);
+        pthread_mutex_unlock(&p->lock);
+        for (int i = 0; i < p->thread_num; i++) {
+            pthread_join(p->threads[i], NULL);
+        }
+        pthread_mutex_destroy(&p->lock);
+        pthread_cond_destroy(&p->start);
+        pthread_cond_destroy(&p->finish);
+        free(p->threads);
+    }
+    p->threads = NULL;
+    p->thread_num = 0;
+}
+
+// Runs job(arg, 0) to job(arg, job_num - 1) in any order, returns when all are done
+void pf_pool_run(PfPool *p, PfJob job, void *arg, int job_num) {
+    if (p->thread_num == 0) {
+        for (int i = 0; i < job_num; i++) {
+            job(arg, i);
+        }
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    p->job = job;
+    p->arg = arg;
+    p->job_num = job_num;
+    p->next_job = 0;
+    p->busy = p->thread_num;
+    p->batch++;
+    pthread_cond_broadcast(&p->start);
+    while (p->next_job < p->job_num) {
+        const int index = p->next_job++;
+        pthread_mutex_unlock(&p->lock);
+        job(arg, index);
+        pthread_mutex_lock(&p->lock);
+    }
+    while (p->busy > 0) {
+        pthread_cond_wait(&p->finish, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Whether parent is under child's feet, m being child's collision with parent
+bool pf_supports(const PfManifold *m, const PfBody *parent, const PfBody *child) {
+    if (parent->mass != 0 || child->mass == 0 || nearzerof(child->gravity.vel)) {
+        return false;
+    }
+    // Mostly along gravity, so walls and ceilings never carry
+    return dotv2f(m->normal, pf_gravity_v2f(child->gravity.dir, 1)) > 0.23;
+}
+
+bool pf_try_connect_parent(const PfManifold *m, PfBody *parent, PfBody *child) {
+    if (pf_supports(m, parent, child)) {
+        child->group.object.parent = parent->handle;
+        return true;
+    }
+    return false;
+}
+
+bool pf_world_init(PfWorld *w, int body_cap) {
+    w->bodies = malloc(sizeof(PfBody) * body_cap);
+    w->contacts = malloc(sizeof(PfContact) * body_cap * 2);
+    w->cache = malloc(sizeof(PfContact) * body_cap * 2);
+    w->cache_num = 0;
+    w->stale = calloc(body_cap, sizeof(bool));
+    w->stale_keys = malloc(sizeof(int) * body_cap);
+    w->stale_num = 0;
+    w->body_num = 0;
+    w->body_cap = body_cap;
+    w->handle_key = malloc(sizeof(int) * (body_cap + 1));
+    w->handle_generation = malloc(sizeof(int) * (body_cap + 1));
+    w->free_handles = malloc(sizeof(int) * body_cap);
+    w->free_handle_num = 0;
+    w->handle_num = 1;
+    w->statics_version = 0;
+    w->contact_num = 0;
+    w->contact_cap = body_cap * 2;
+    w->dt = 1.0 / 60.0;
+    w->accumulator = 0;
+    w->max_steps = 5;
+    w->before_step = NULL;
+    w->step_arg = NULL;
+    w->iterations = 1;
+    w->sleep_steps = 60;
+    w->broadphase = PF_BROADPHASE_NONE;
+    w->grid = (PfGrid) { .buckets = NULL, .entries = NULL, .proxies = NULL };
+    w->sap = (PfSap) { .endpoints = NULL, .proxies = NULL, .sweep = NULL };
+    w->statics = (PfBvh) { .nodes = NULL, .node_num = 0, .root = -1, .leaves = NULL, .key_cap = 0 };
+    w->loose = malloc(sizeof(int) * body_cap);
+    w->loose_num = 0;
+    w->pairs = (PfPairList) { .pairs = NULL, .num = 0, .cap = 0 };
+    w->support = (PfPairList) { .pairs = NULL, .num = 0, .cap = 0 };
+    w->hits = malloc(sizeof(int) * body_cap);
+    w->narrow = NULL;
+    w->narrow_num = NULL;
+    w->narrow_cap = 0;
+    pf_pool_init(&w->pool, 0);
+    w->island_root = malloc(sizeof(int) * body_cap);
+    w->island_id = malloc(sizeof(int) * body_cap);
+    w->island_of = malloc(sizeof(int) * body_cap * 2);
+    w->island_start = malloc(sizeof(int) * (body_cap * 2 + 1));
+    w->island_contacts = malloc(sizeof(int) * body_cap * 2);
+    w->island_num = 0;
+    w->trace = (PfTrace) { .events = NULL, .cap = 0, .next = 0 };
+    const bool boxes = pf_aabb_array_init(&w->boxes, body_cap);
+    const bool loose_boxes = pf_aabb_array_init(&w->loose_boxes, body_cap);
+    const bool swept = pf_aabb_array_init(&w->swept, body_cap);
+    const bool store = pf_store_init(&w->store, body_cap);
+    const bool islands =
+        w->island_root && w->island_id && w->island_of &&
+        w->island_start && w->island_contacts;
+    const bool handles = w->handle_key && w->handle_generation && w->free_handles;
+    if (!w->bodies || !w->contacts || !w->cache || !w->stale || !w->stale_keys || !w->loose || !w->hits || !islands || !handles || !boxes || !loose_boxes || !swept || !store) {
+        pf_world_free(w);
+        return false;
+    }
+    w->handle_key[0] = -1;
+    w->handle_generation[0] = 0;
+    pf_world_reset_stats(w);
+    return true;
+}
+
+void pf_world_free(PfWorld *w) {
+    pf_world_use_brute_force(w);
+    pf_bvh_free(&w->statics);
+    free(w->loose);
+    w->loose = NULL;
+    pf_pair_list_free(&w->pairs);
+    pf_pair_list_free(&w->support);
+    pf_store_free(&w->store);
+    pf_aabb_array_free(&w->boxes);
+    pf_aabb_array_free(&w->loose_boxes);
+    pf_aabb_array_free(&w->swept);
+    free(w->hits);
+    pf_pool_free(&w->pool);
+    free(w->narrow);
+    free(w->narrow_num);
+    w->narrow = NULL;
+    w->narrow_num = NULL;
+    w->narrow_cap = 0;
+    free(w->island_root);
+    free(w->island_id);
+    free(w->island_of);
+    free(w->island_start);
+    free(w->island_contacts);
+    w->island_root = NULL;
+    w->island_id = NULL;
+    w->island_of = NULL;
+    w->island_start = NULL;
+    w->island_contacts = NULL;
+    w->island_num = 0;
+    pf_world_trace(w, 0);
+    free(w->bodies);
+    free(w->contacts);
+    free(w->cache);
+    free(w->stale);
+    free(w->stale_keys);
+    free(w->handle_key);
+    free(w->handle_generation);
+    free(w->free_handles);
+    w->handle_key = NULL;
+    w->handle_generation = NULL;
+    w->free_handles = NULL;
+    w->free_handle_num = 0;
+    w->handle_num = 1;
+    w->cache = NULL;
+    w->cache_num = 0;
+    w->stale = NULL;
+    w->stale_keys = NULL;
+    w->stale_num = 0;
+    w->hits = NULL;
+    w->bodies = NULL;
+    w->contacts = NULL;
+    w->body_num = 0;
+    w->contact_num = 0;
+}
+
+void pf_world_use_brute_force(PfWorld *w) {
+    switch (w->broadphase) {
+    case PF_BROADPHASE_GRID:
+        pf_grid_free(&w->grid);
+        break;
+    case PF_BROADPHASE_SAP:
+        pf_sap_free(&w->sap);
+        break;
+    default:
+        break;
+    }
+    w->broadphase = PF_BROADPHASE_NONE;
+}
+
+// Narrowphase and islands run on thread_num threads counting the caller, 1 or less runs them serially
+bool pf_world_use_threads(PfWorld *w, int thread_num) {
+    pf_pool_free(&w->pool);
+    return pf_pool_init(&w->pool, thread_num - 1);
+}
+
+bool pf_world_use_grid(PfWorld *w, float cell_size) {
+    pf_world_use_brute_force(w);
+    if (!pf_grid_init(&w->grid, cell_size, w->body_cap)) {
+        return false;
+    }
+    w->broadphase = PF_BROADPHASE_GRID;
+    return true;
+}
+
+bool pf_world_in_static_tree(const PfWorld *w, int key) {
+    return w->statics.root != -1 && w->statics.leaves[key] != -1;
+}
+
+// Pairs of two fixed bodies are never tested
+bool pf_body_is_fixed(const PfBody *a) {
+    return a->mass == 0 || a->asleep;
+}
+
+void pf_world_remove_proxy(PfWorld *w, int key) {
+    switch (w->broadphase) {
+    case PF_BROADPHASE_GRID:
+        pf_grid_remove(&w->grid, key);
+        break;
+    case PF_BROADPHASE_SAP:
+        pf_sap_remove(&w->sap, key);
+        break;
+    default:
+        break;
+    }
+}
+
+// Massless static bodies go into the tree; rebuild after adding level geometry
+// or changing its layers
+bool pf_world_build_static_tree(PfWorld *w) {
+    int *keys = malloc(sizeof(int) * w->body_cap);
+    PfAabb *boxes = malloc(sizeof(PfAabb) * w->body_cap);
+    unsigned *categories = malloc(sizeof(unsigned) * w->body_cap);
+    unsigned *masks = malloc(sizeof(unsigned) * w->body_cap);
+    int n = 0;
+    pf_bvh_free(&w->statics);
+    if (!keys || !boxes || !categories || !masks) {
+        free(keys);
+        free(boxes);
+        free(categories);
+        free(masks);
+        return false;
+    }
+    for (int i = 0; i < w->body_num; i++) {
+        const PfBody *a = &w->bodies[i];
+        if (a->mode == PF_MODE_STATIC && a->mass == 0) {
+            keys[n] = i;
+            boxes[n] = pf_body_to_aabb(a);
+            categories[n] = a->category;
+            masks[n] = a->mask;
+            n++;
+        }
+    }
+    const bool built = pf_bvh_build(&w->statics, keys, boxes, categories, masks, n, w->body_cap);
+    free(keys);
+    free(boxes);
+    free(categories);
+    free(masks);
+    w->statics_version++;
+    if (!built) {
+        return false;
+    }
+    for (int i = 0; i < w->body_num; i++) {
+        if (pf_world_in_static_tree(w, i)) {
+            pf_world_remove_proxy(w, i);
+        }
+    }
+    return true;
+}
+
+void pf_world_refit_static(PfWorld *w, int key) {
+    if (pf_world_in_static_tree(w, key)) {
+        const PfAabb box = pf_body_to_aabb(&w->bodies[key]);
+        pf_bvh_refit(&w->statics, key, &box);
+    }
+}
+
+bool pf_world_use_sap(PfWorld *w) {
+    pf_world_use_brute_force(w);
+    if (!pf_sap_init(&w->sap, w->body_cap)) {
+        return false;
+    }
+    w->broadphase = PF_BROADPHASE_SAP;
+    return true;
+}
+
+bool pf_handle_eq(PfHandle a, PfHandle b) {
+    return a.index == b.index && a.generation == b.generation;
+}
+
+bool pf_handle_none(PfHandle h) {
+    return h.index == 0;
+}
+
+// Key of the body h names in these tables, -1 if it names none
+int pf_handle_lookup(const int *handle_key, const int *handle_generation, int handle_num, PfHandle h) {
+    if (h.index <= 0 || h.index >= handle_num || handle_generation[h.index] != h.generation) {
+        return -1;
+    }
+    return handle_key[h.index];
+}
+
+int pf_world_handle_key(const PfWorld *w, PfHandle h) {
+    return pf_handle_lookup(w->handle_key, w->handle_generation, w->handle_num, h);
+}
+
+// The body h names, NULL once it was destroyed. Pointers last until a body is
+// destroyed, handles until their own is.
+PfBody* pf_world_get(const PfWorld *w, PfHandle h) {
+    const int key = pf_world_handle_key(w, h);
+    return key == -1 ? NULL : &w->bodies[key];
+}
+
+// Keep a->handle when resetting the body, the world gave it
+PfBody* pf_world_add_body(PfWorld *w) {
+    if (w->body_num == w->body_cap) {
+        return NULL;
+    }
+    // Freed slots first, so the table never outgrows the bodies
+    int slot;
+    if (w->free_handle_num > 0) {
+        slot = w->free_handles[--w->free_handle_num];
+    } else {
+        slot = w->handle_num++;
+        w->handle_generation[slot] = 0;
+    }
+    w->handle_key[slot] = w->body_num;
+    pf_store_rest(&w->store, w->body_num);
+    PfBody *a = &w->bodies[w->body_num];
+    w->body_num++;
+    *a = _pf_body();
+    a->handle = (PfHandle) { .index = slot, .generation = w->handle_generation[slot] };
+    return a;
+}
+
+PfHandle pf_world_create_body(PfWorld *w) {
+    const PfBody *a = pf_world_add_body(w);
+    return a ? a->handle : PF_NO_HANDLE;
+}
+
+// Decays, caps, gravity and mass of a moving body are read once when it
+// starts moving, call this after changing them
+void pf_world_reload_body(PfWorld *w, PfHandle h) {
+    const int key = pf_world_handle_key(w, h);
+    if (key != -1) {
+        pf_store_rest(&w->store, key);
+    }
+}
+
+// Cached contacts of key stop counting, the cache itself is left alone and
+// drops them when the next step rebuilds it
+void pf_world_forget_contacts(PfWorld *w, int key) {
+    if (!w->stale[key]) {
+        w->stale[key] = true;
+        w->stale_keys[w->stale_num++] = key;
+    }
+}
+
+void pf_world_clear_stale(PfWorld *w) {
+    for (int i = 0; i < w->stale_num; i++) {
+        w->stale[w->stale_keys[i]] = false;
+    }
+    w->stale_num = 0;
+}
+
+bool pf_world_cached(const PfWorld *w, const PfContact *c) {
+    return !w->stale[c->a_key] && !w->stale[c->b_key];
+}
+
+// Moves the last body into the gap so bodies stay dense, false if h is stale.
+// O(1) except for removing a SAP proxy, which is O(n) in the endpoints, and
+// destroying level geometry, which rebuilds the static tree.
+bool pf_world_destroy_body(PfWorld *w, PfHandle h) {
+    const int key = pf_world_handle_key(w, h);
+    if (key == -1) {
+        return false;
+    }
+    const int last = w->body_num - 1;
+    const bool rebuild = pf_world_in_static_tree(w, key);
+    pf_world_remove_proxy(w, key);
+    pf_world_remove_proxy(w, last);
+    pf_world_forget_contacts(w, key);
+    pf_world_forget_contacts(w, last);
+    pf_store_rest(&w->store, key);
+    pf_store_rest(&w->store, last);
+    w->contact_num = 0;
+    if (w->statics.root != -1 && !rebuild && pf_world_in_static_tree(w, last)) {
+        pf_bvh_rekey(&w->statics, last, key);
+        w->statics_version++;
+    }
+    w->bodies[key] = w->bodies[last];
+    w->handle_key[w->bodies[key].handle.index] = key;
+    w->body_num--;
+    w->handle_key[h.index] = -1;
+    w->handle_generation[h.index]++;
+    w->free_handles[w->free_handle_num++] = h.index;
+    if (rebuild) {
+        pf_world_build_static_tree(w);
+    }
+    return true;
+}
+
+bool pf_body_is_child_of(const PfBody *a, const PfBody *b) {
+    return !pf_handle_none(a->group.object.parent) && pf_handle_eq(a->group.object.parent, b->handle);
+}
+
+bool pf_is_parent_of(const PfBody *a, const PfBody *b) {
+    return pf_body_is_child_of(a, b) || pf_body_is_child_of(b, a);
+}
+
+// pf_solve_collision, counted in the stats of w
+bool pf_world_solve_collision(PfWorld *w, const PfBody *a, const PfBody *b, PfManifold *m) {
+    PF_STATS_NARROW(w, a, b, 1);
+    return pf_solve_collision(a, b, m);
+}
+
+bool pf_world_try_attach(PfWorld *w, PfBody *a, PfBody *b) {
+    PfManifold m;
+    if (pf_world_solve_collision(w, a, b, &m)) {
+        // Keep the slop so the parent is still touched next step
+        const v2f penetration = mulv2nf(m.normal, fmaxf(0, m.penetration - PF_SLOP));
+        if (pf_try_connect_parent(&m, b, a)) {
+            a->pos = subv2f(a->pos, penetration);
+            return true;
+        }
+    }
+    return false;
+}
+
+// The half of a body's box on its gravity side, anything it stands on overlaps it there
+PfAabb pf_body_feet(const PfBody *a) {
+    PfAabb box = pf_body_to_aabb(a);
+    const v2f center = pf_aabb_pos(&box);
+    switch (a->gravity.dir) {
+    case PF_DIR_U:
+        box.max.y = center.y;
+        break;
+    case PF_DIR_D:
+        box.min.y = center.y;
+        break;
+    case PF_DIR_L:
+        box.max.x = center.x;
+        break;
+    case PF_DIR_R:
+        box.min.x = center.x;
+        break;
+    }
+    return box;
+}
+
+// Massless bodies whose bounds meet box, as (i, body) pairs in support.
+// Bodies off its layers can't carry or stop it, so they are left out.
+bool pf_world_find_massless(PfWorld *w, int i, const PfAabb *box) {
+    const PfBody *a = &w->bodies[i];
+    w->support.num = 0;
+    if (!pf_bvh_query(&w->statics, box, i, a->category, a->mask, &w->support)) {
+        return false;
+    }
+    const int hit_num = pf_aabb_array_query(&w->loose_boxes, box, w->hits);
+    for (int k = 0; k < hit_num; k++) {
+        const int j = w->loose[w->hits[k]];
+        if (j != i && pf_layers_meet(a, &w->bodies[j]) && !pf_pair_list_push(&w->support, i, j)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sorted massless bodies under the feet of body i, keyed above after
+bool pf_world_find_supports(PfWorld *w, int i, int after) {
+    const PfAabb box = pf_body_feet(&w->bodies[i]);
+    if (!pf_world_find_massless(w, i, &box)) {
+        return false;
+    }
+    int n = 0;
+    for (int k = 0; k < w->support.num; k++) {
+        if (w->support.pairs[k].b > after) {
+            w->support.pairs[n++] = w->support.pairs[k];
+        }
+    }
+    w->support.num = n;
+    pf_pair_list_sort(&w->support);
+    return true;
+}
+
+// Only massless bodies can become parents, so only those are visited
+void pf_world_attach(PfWorld *w, int i) {
+    PfBody *a = &w->bodies[i];
+    if (a->mass == 0 || !pf_world_find_supports(w, i, -1)) {
+        return;
+    }
+    for (int k = 0; k < w->support.num; k++) {
+        const int j = w->support.pairs[k].b;
+        // Attaching moves the body, so look again from where it is now
+        if (pf_world_try_attach(w, a, &w->bodies[j])) {
+            if (!pf_world_find_supports(w, i, j)) {
+                return;
+            }
+            k = -1;
+        }
+    }
+}
+
+// Detach objects from lost parents and attach parentless objects to what they stand on
+void pf_world_relations_prepare(PfWorld *w) {
+    // Massless bodies don't move while relations are updated
+    w->loose_num = 0;
+    w->loose_boxes.num = 0;
+    for (int i = 0; i < w->body_num; i++) {
+        if (w->bodies[i].mass == 0 && !pf_world_in_static_tree(w, i)) {
+            const PfAabb box = pf_body_to_aabb(&w->bodies[i]);
+            pf_aabb_array_push(&w->loose_boxes, &box);
+            w->loose[w->loose_num++] = i;
+        }
+    }
+}
+
+void pf_world_relations(PfWorld *w) {
+    pf_world_relations_prepare(w);
+    for (int i = 0; i < w->body_num; i++) {
+        PfBody *a = &w->bodies[i];
+        PfManifold m;
+
+        if (a->mode != PF_MODE_DYNAMIC || a->asleep) {
+            continue;
+        }
+
+        // Decide to detach from parent, which may have been destroyed
+        const PfBody *parent = pf_world_get(w, a->group.object.parent);
+        if (parent && pf_layers_meet(a, parent) && pf_world_solve_collision(w, a, parent, &m)) {
+            continue;
+        }
+        PF_STATS_ADD(w, detaches, !pf_handle_none(a->group.object.parent));
+        a->group.object.parent = PF_NO_HANDLE;
+
+        // Find parent to to attach
+        pf_world_attach(w, i);
+        PF_STATS_ADD(w, attaches, !pf_handle_none(a->group.object.parent));
+    }
+}
+
+// First body under key's feet that would carry it, NULL if it has no ground
+const PfBody* pf_world_find_ground(PfWorld *w, int key) {
+    const PfBody *a = &w->bodies[key];
+    pf_world_relations_prepare(w);
+    if (a->mass == 0 || !pf_world_find_supports(w, key, -1)) {
+        return NULL;
+    }
+    for (int k = 0; k < w->support.num; k++) {
+        const PfBody *b = &w->bodies[w->support.pairs[k].b];
+        PfManifold m;
+        if (pf_world_solve_collision(w, a, b, &m) && pf_supports(&m, b, a)) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+// Sleeping bodies a platform moved into wake, or their pair with it would
+// never be tested
+void pf_world_wake_swept(PfWorld *w) {
+    if (w->swept.num == 0) {
+        return;
+    }
+    for (int i = 0; i < w->body_num; i++) {
+        PfBody *a = &w->bodies[i];
+        if (!a->asleep) {
+            continue;
+        }
+        const PfAabb box = pf_body_to_aabb(a);
+        if (pf_aabb_array_query(&w->swept, &box, w->hits) > 0) {
+            pf_body_wake(a);
+        }
+    }
+}
+
+// Static bodies only move by their internal impulse and never collide
+void pf_world_move_platforms(PfWorld *w, float dt) {
+    w->swept.num = 0;
+    for (int i = 0; i < w->body_num; i++) {
+        PfBody *a = &w->bodies[i];
+        if (a->mode == PF_MODE_STATIC) {
+            pf_update_dpos(dt, a);
+            pf_apply_dpos(a);
+            pf_step_forces(dt, a);
+            if (a->dpos.x != 0 || a->dpos.y != 0) {
+                pf_world_refit_static(w, i);
+                const PfAabb to = pf_body_to_aabb(a);
+                const PfAabb from = { .min = subv2f(to.min, a->dpos), .max = subv2f(to.max, a->dpos) };
+                const PfAabb swept = pf_aabb_union(&from, &to);
+                pf_aabb_array_push(&w->swept, &swept);
+            }
+        }
+    }
+    pf_world_wake_swept(w);
+}
+
+void pf_world_carry_objects(PfWorld *w) {
+    for (int i = 0; i < w->body_num; i++) {
+        PfBody *a = &w->bodies[i];
+        const PfBody *parent = a->mode == PF_MODE_DYNAMIC ? pf_world_get(w, a->group.object.parent) : NULL;
+        if (parent && parent->mode == PF_MODE_STATIC) {
+            const v2f dpos = parent->dpos;
+            if (a->asleep && (!nearzerof(dpos.x) || !nearzerof(dpos.y))) {
+                pf_body_wake(a);
+            }
+            a->pos = addv2f(a->pos, dpos);
+        }
+    }
+}
+
+// Only reads the world, so many threads can collide at once
+bool pf_world_collide(const PfWorld *w, int i, int j, PfContact *c) {
+    if (!pf_solve_collision(&w->bodies[i], &w->bodies[j], &c->manifold)) {
+        return false;
+    }
+    c->a_key = i;
+    c->b_key = j;
+    c->normal_impulse = 0;
+    c->tangent_impulse = 0;
+    c->bounce = 0;
+    return true;
+}
+
+bool pf_world_push_contact(PfWorld *w, int i, int j) {
+    PF_STATS_NARROW(w, &w->bodies[i], &w->bodies[j], 1);
+    if (pf_world_collide(w, i, j, &w->contacts[w->contact_num])) {
+        w->contact_num++;
+    }
+    return w->contact_num < w->contact_cap;
+}
+
+void pf_world_update_boxes(PfWorld *w) {
+    w->boxes.num = 0;
+    for (int i = 0; i < w->body_num; i++) {
+        const PfAabb box = pf_body_to_aabb(&w->bodies[i]);
+        pf_aabb_array_push(&w->boxes, &box);
+    }
+}
+
+// Writes the key of every body overlapping box to out, returns how many.
+// Level geometry comes from the static tree, only bodies outside it are
+// tested. Geometry moved by hand is found where it is once a step refits it.
+int pf_world_query(const PfWorld *w, const PfAabb *box, int *out) {
+    int n = pf_bvh_collect(&w->statics, box, out);
+    for (int i = 0; i < w->body_num; i++) {
+        if (pf_world_in_static_tree(w, i)) {
+            continue;
+        }
+        const PfAabb a_box = pf_body_to_aabb(&w->bodies[i]);
+        if (pf_intersect(box, &a_box)) {
+            out[n++] = i;
+        }
+    }
+    return n;
+}
+
+// Sleeping bodies don't move, their proxy only has to be marked fixed once
+// and updated again if their layers change
+bool pf_world_proxy_asleep(const PfWorld *w, int i) {
+    const PfBody *a = &w->bodies[i];
+    if (!a->asleep) {
+        return false;
+    }
+    switch (w->broadphase) {
+    case PF_BROADPHASE_GRID: {
+        const PfGridProxy *p = &w->grid.proxies[i];
+        return p->first != -1 && p->fixed && p->category == a->category && p->mask == a->mask;
+    }
+    case PF_BROADPHASE_SAP: {
+        const PfSapProxy *p = &w->sap.proxies[i];
+        return p->active && p->fixed && p->category == a->category && p->mask == a->mask;
+    }
+    default:
+        return false;
+    }
+}
+
+bool pf_world_find_loose_pairs(PfWorld *w) {
+    w->pairs.num = 0;
+    switch (w->broadphase) {
+    case PF_BROADPHASE_GRID:
+        for (int i = 0; i < w->body_num; i++) {
+            const PfBody *a = &w->bodies[i];
+            if (pf_world_in_static_tree(w, i) || pf_world_proxy_asleep(w, i)) {
+                continue;
+            }
+            const PfAabb box = pf_body_to_aabb(a);
+            if (!pf_grid_update(&w->grid, i, &box, pf_body_is_fixed(a), a->category, a->mask)) {
+                return false;
+            }
+        }
+        return pf_grid_find_pairs(&w->grid, &w->pairs);
+    case PF_BROADPHASE_SAP:
+        for (int i = 0; i < w->body_num; i++) {
+            const PfBody *a = &w->bodies[i];
+            if (pf_world_in_static_tree(w, i) || pf_world_proxy_asleep(w, i)) {
+                continue;
+            }
+            const PfAabb box = pf_body_to_aabb(a);
+            pf_sap_update(&w->sap, i, &box, pf_body_is_fixed(a), a->category, a->mask);
+        }
+        if (!pf_sap_find_pairs(&w->sap)) {
+            return false;
+        }
+        for (int i = 0; i < w->sap.pairs.num; i++) {
+            if (!pf_pair_list_push(&w->pairs, w->sap.pairs.pairs[i].a, w->sap.pairs.pairs[i].b)) {
+                return false;
+            }
+        }
+        return true;
+    default:
+        pf_world_update_boxes(w);
+        for (int i = 0; i < w->body_num; i++) {
+            if (pf_world_in_static_tree(w, i)) {
+                continue;
+            }
+            const PfAabb a_box = pf_body_to_aabb(&w->bodies[i]);
+            const PfAabbArray *b = &w->boxes;
+            const int from = i + 1;
+            const int hit_num = pf_aabb_query_batch(&a_box,
+                b->min_x + from, b->min_y + from, b->max_x + from, b->max_y + from,
+                b->num - from, w->hits);
+            for (int k = 0; k < hit_num; k++) {
+                const int j = from + w->hits[k];
+                if (pf_world_in_static_tree(w, j) ||
+                    (pf_body_is_fixed(&w->bodies[i]) && pf_body_is_fixed(&w->bodies[j])) ||
+                    !pf_layers_meet(&w->bodies[i], &w->bodies[j])) {
+                    continue;
+                }
+                if (!pf_pair_list_push(&w->pairs, i, j)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+}
+
+bool pf_world_find_static_pairs(PfWorld *w) {
+    for (int i = 0; i < w->body_num; i++) {
+        const PfBody *a = &w->bodies[i];
+        if (pf_body_is_fixed(a) || pf_world_in_static_tree(w, i)) {
+            continue;
+        }
+        const int from = w->pairs.num;
+        const PfAabb box = pf_body_to_aabb(a);
+        if (!pf_bvh_query(&w->statics, &box, i, a->category, a->mask, &w->pairs)) {
+            return false;
+        }
+        for (int k = from; k < w->pairs.num; k++) {
+            PfPair *p = &w->pairs.pairs[k];
+            if (p->b < p->a) {
+                *p = (PfPair) { .a = p->b, .b = p->a };
+            }
+        }
+    }
+    return true;
+}
+
+// Candidates come out sorted, so contacts keep the brute force order
+const PfPairList* pf_world_find_pairs(PfWorld *w) {
+    if (w->broadphase == PF_BROADPHASE_NONE && w->statics.root == -1) {
+        return NULL;
+    }
+    if (!pf_world_find_loose_pairs(w)) {
+        return NULL;
+    }
+    if (w->statics.root != -1 && !pf_world_find_static_pairs(w)) {
+        return NULL;
+    }
+    pf_pair_list_sort(&w->pairs);
+    return &w->pairs;
+}
+
+// Chunks don't depend on the thread count, so neither does the contact order
+#define PF_NARROW_CHUNK 256
+
+void pf_world_narrow_chunk(void *arg, int chunk) {
+    PfWorld *w = arg;
+    PF_TRACE_BEGIN();
+    const int from = chunk * PF_NARROW_CHUNK;
+    const int to = from + PF_NARROW_CHUNK < w->pairs.num ? from + PF_NARROW_CHUNK : w->pairs.num;
+    PfContact *out = &w->narrow[from];
+    int n = 0;
+    for (int k = from; k < to; k++) {
+        n += pf_world_collide(w, w->pairs.pairs[k].a, w->pairs.pairs[k].b, &out[n]);
+    }
+    w->narrow_num[chunk] = n;
+    PF_TRACE_END(w, "narrow chunk");
+}
+
+bool pf_world_reserve_narrow(PfWorld *w, int pair_num) {
+    if (pair_num <= w->narrow_cap) {
+        return true;
+    }
+    const int cap = (pair_num / PF_NARROW_CHUNK + 1) * PF_NARROW_CHUNK * 2;
+    PfContact *narrow = realloc(w->narrow, sizeof(PfContact) * cap);
+    if (!narrow) {
+        return false;
+    }
+    w->narrow = narrow;
+    int *narrow_num = realloc(w->narrow_num, sizeof(int) * (cap / PF_NARROW_CHUNK));
+    if (!narrow_num) {
+        return false;
+    }
+    w->narrow_num = narrow_num;
+    w->narrow_cap = cap;
+    return true;
+}
+
+// Collides chunks on the pool, then appends their contacts in chunk order
+bool pf_world_generate_contacts_threaded(PfWorld *w) {
+    if (w->pool.thread_num == 0 ||
+        w->pairs.num <= PF_NARROW_CHUNK ||
+        !pf_world_reserve_narrow(w, w->pairs.num)) {
+        return false;
+    }
+    const int chunk_num = (w->pairs.num + PF_NARROW_CHUNK - 1) / PF_NARROW_CHUNK;
+    pf_pool_run(&w->pool, pf_world_narrow_chunk, w, chunk_num);
+#ifdef PF_STATS
+    // Chunks only read the world, so the call each pair got is counted here
+    for (int k = 0; k < w->pairs.num; k++) {
+        PF_STATS_NARROW(w, &w->bodies[w->pairs.pairs[k].a], &w->bodies[w->pairs.pairs[k].b], 1);
+    }
+#endif
+    for (int chunk = 0; chunk < chunk_num; chunk++) {
+        const PfContact *found = &w->narrow[chunk * PF_NARROW_CHUNK];
+        for (int k = 0; k < w->narrow_num[chunk]; k++) {
+            w->contacts[w->contact_num++] = found[k];
+            if (w->contact_num == w->contact_cap) {
+                return true;
+            }
+        }
+    }
+    return true;
+}
+
+void pf_world_generate_contacts(PfWorld *w) {
+    const PfPairList *pairs = pf_world_find_pairs(w);
+    PF_STATS_ADD(w, pair_tests, pairs ? pairs->num : 0);
+    if (pairs && pf_world_generate_contacts_threaded(w)) {
+        return;
+    }
+    if (pairs) {
+        for (int i = 0; i < pairs->num; i++) {
+            if (!pf_world_push_contact(w, pairs->pairs[i].a, pairs->pairs[i].b)) {
+                return;
+            }
+        }
+        return;
+    }
+    for (int i = 0; i < w->body_num; i++) {
+        const PfBody *a = &w->bodies[i];
+        for (int j = i + 1; j < w->body_num; j++) {
+            const PfBody *b = &w->bodies[j];
+            if ((pf_body_is_fixed(a) && pf_body_is_fixed(b)) || !pf_layers_meet(a, b)) {
+                continue;
+            }
+            PF_STATS_ADD(w, pair_tests, 1);
+            if (!pf_world_push_contact(w, i, j)) {
+                return;
+            }
+        }
+    }
+}
+
+// Runs the store passes over every slot. Bodies that start moving have their
+// settings loaded, bodies that stop are left at rest in the store.
+void pf_world_integrate(PfWorld *w, float dt) {
+    PfBodyStore *s = &w->store;
+    for (int i = 0; i < w->body_num; i++) {
+        const PfBody *a = &w->bodies[i];
+        if (a->mode == PF_MODE_DYNAMIC && !a->asleep) {
+            if (!s->moving[i]) {
+                pf_store_load(s, i, a);
+            }
+            pf_store_pull(s, i, a);
+        } else if (s->moving[i]) {
+            pf_store_rest(s, i);
+        }
+    }
+    s->num = w->body_num;
+    pf_store_update_dpos(dt, s);
+    pf_store_apply_dpos(s);
+    pf_store_step_forces(dt, s);
+    for (int i = 0; i < w->body_num; i++) {
+        if (s->moving[i]) {
+            pf_store_push(s, i, &w->bodies[i]);
+        }
+    }
+}
+
+// The shape shrunk by twice the slop, so resting and grazing contacts never stop it
+PfBody pf_body_core(const PfBody *a) {
+    PfBody core = *a;
+    const float margin = 2 * PF_SLOP;
+    switch (a->shape.tag) {
+    case PF_SHAPE_RECT:
+        core.shape.radii = _v2f(fmaxf(a->shape.radii.x - margin, a->shape.radii.x / 2),
+                                fmaxf(a->shape.radii.y - margin, a->shape.radii.y / 2));
+        break;
+    case PF_SHAPE_CIRCLE:
+        core.shape.radius = fmaxf(a->shape.radius - margin, a->shape.radius / 2);
+        break;
+    case PF_SHAPE_TRI:
+        core.shape.tri.radii = _v2f(fmaxf(a->shape.tri.radii.x - margin, a->shape.tri.radii.x / 2),
+                                    fmaxf(a->shape.tri.radii.y - margin, a->shape.tri.radii.y / 2));
+        break;
+    }
+    return core;
+}
+
+// Bodies flagged ccd stop at the first massless body their step would pass into,
+// then slide along it for the rest of the step. Their core touches it there, so
+// the shape sinks in by the slop and the usual platform contacts take over.
+void pf_world_sweep_bodies(PfWorld *w) {
+    bool prepared = false;
+    for (int i = 0; i < w->body_num; i++) {
+        PfBody *a = &w->bodies[i];
+        if (!a->ccd || a->mode != PF_MODE_DYNAMIC || a->asleep || (a->dpos.x == 0 && a->dpos.y == 0)) {
+            continue;
+        }
+        if (!prepared) {
+            pf_world_relations_prepare(w);
+            prepared = true;
+        }
+        PfBody from = pf_body_core(a);
+        from.pos = subv2f(a->pos, a->dpos);
+        v2f d = a->dpos;
+        for (int pass = 0; pass < PF_SWEEP_PASSES; pass++) {
+            PfBody to = from;
+            to.pos = addv2f(from.pos, d);
+            const PfAabb from_box = pf_body_to_aabb(&from);
+            const PfAabb to_box = pf_body_to_aabb(&to);
+            const PfAabb box = pf_aabb_union(&from_box, &to_box);
+            if (!pf_world_find_massless(w, i, &box)) {
+                break;
+            }
+            float toi = 1;
+            v2f normal = _v2f(0, 0);
+            for (int k = 0; k < w->support.num; k++) {
+                const PfBody *b = &w->bodies[w->support.pairs[k].b];
+                v2f n;
+                int calls;
+                const float t = pf_time_of_impact_calls(&from, d, b, &n, &calls);
+                PF_STATS_NARROW(w, &from, b, calls);
+                if (t < toi) {
+                    toi = t;
+                    normal = n;
+                }
+            }
+            if (toi == 1) {
+                from = to;
+                break;
+            }
+            from.pos = addv2f(from.pos, mulv2nf(d, toi));
+            d = mulv2nf(d, 1 - toi);
+            d = subv2f(d, mulv2nf(normal, fmaxf(0, dotv2f(d, normal))));
+        }
+        a->dpos = addv2f(a->dpos, subv2f(from.pos, a->pos));
+        a->pos = from.pos;
+    }
+}
+
+// Bodies that shouldn't push each other are kept apart by their layers
+bool pf_pushes_objects(const PfBody *a) {
+    return a->mode == PF_MODE_DYNAMIC;
+}
+
+bool pf_world_solves_contact(const PfBody *a, const PfBody *b) {
+    return (a->mode != PF_MODE_STATIC && b->mode != PF_MODE_STATIC) || pf_is_parent_of(a, b);
+}
+
+bool pf_contact_before(const PfContact *a, const PfContact *b) {
+    return a->a_key < b->a_key || (a->a_key == b->a_key && a->b_key < b->b_key);
+}
+
+// Pairs still touching about the same way start from last step's impulses
+void pf_world_recall_impulses(PfWorld *w) {
+    int k = 0;
+    for (int i = 0; i < w->contact_num; i++) {
+        PfContact *c = &w->contacts[i];
+        if (!pf_world_solves_contact(&w->bodies[c->a_key], &w->bodies[c->b_key])) {
+            continue;
+        }
+        while (k < w->cache_num && pf_contact_before(&w->cache[k], c)) {
+            k++;
+        }
+        if (k < w->cache_num &&
+            pf_world_cached(w, &w->cache[k]) &&
+            w->cache[k].a_key == c->a_key &&
+            w->cache[k].b_key == c->b_key &&
+            dotv2f(w->cache[k].manifold.normal, c->manifold.normal) > 0.9) {
+            c->normal_impulse = w->cache[k].normal_impulse;
+            c->tangent_impulse = w->cache[k].tangent_impulse;
+        }
+    }
+}
+
+int pf_island_find(int *root, int i) {
+    while (root[i] != i) {
+        root[i] = root[root[i]];
+        i = root[i];
+    }
+    return i;
+}
+
+// Dynamic bodies touching each other share an island, static ones join none
+void pf_world_build_islands(PfWorld *w) {
+    for (int i = 0; i < w->body_num; i++) {
+        w->island_root[i] = i;
+        w->island_id[i] = -1;
+    }
+    for (int i = 0; i < w->contact_num; i++) {
+        const PfContact *c = &w->contacts[i];
+        if (w->bodies[c->a_key].mode == PF_MODE_DYNAMIC && w->bodies[c->b_key].mode == PF_MODE_DYNAMIC) {
+            const int a = pf_island_find(w->island_root, c->a_key);
+            const int b = pf_island_find(w->island_root, c->b_key);
+            // Lower root wins so islands don't depend on contact order
+            w->island_root[a > b ? a : b] = a < b ? a : b;
+        }
+    }
+    w->island_num = 0;
+    for (int i = 0; i < w->contact_num; i++) {
+        const PfContact *c = &w->contacts[i];
+        const int owner = w->bodies[c->a_key].mode == PF_MODE_DYNAMIC ? c->a_key : c->b_key;
+        const int r = pf_island_find(w->island_root, owner);
+        if (w->island_id[r] == -1) {
+            w->island_id[r] = w->island_num;
+            w->island_start[w->island_num++] = 0;
+        }
+        w->island_of[i] = w->island_id[r];
+        w->island_start[w->island_id[r]]++;
+    }
+    // Counts to offsets, contacts keep their order within an island
+    int sum = 0;
+    for (int i = 0; i < w->island_num; i++) {
+        const int n = w->island_start[i];
+        w->island_start[i] = sum;
+        sum += n;
+    }
+    w->island_start[w->island_num] = sum;
+    for (int i = 0; i < w->contact_num; i++) {
+        w->island_contacts[w->island_start[w->island_of[i]]++] = i;
+    }
+    for (int i = w->island_num; i > 0; i--) {
+        w->island_start[i] = w->island_start[i - 1];
+    }
+    w->island_start[0] = 0;
+}
+
+bool pf_body_at_rest(const PfBody *a) {
+    return
+        a->mode != PF_MODE_DYNAMIC || (
+            nearzerof(a->in.impulse.x) && nearzerof(a->in.impulse.y) &&
+            nearzerof(a->ex.impulse.x) && nearzerof(a->ex.impulse.y) &&
+            (!pf_handle_none(a->group.object.parent) || nearzerof(a->gravity.vel)));
+}
+
+// Nothing moves and nothing overlaps past the slop, so solving would change nothing
+bool pf_world_island_at_rest(const PfWorld *w, int island) {
+    for (int k = w->island_start[island]; k < w->island_start[island + 1]; k++) {
+        const PfContact *c = &w->contacts[w->island_contacts[k]];
+        if (c->manifold.penetration > PF_SLOP ||
+            c->normal_impulse != 0 ||
+            !pf_body_at_rest(&w->bodies[c->a_key]) ||
+            !pf_body_at_rest(&w->bodies[c->b_key])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifdef PF_STATS
+// Islands are solved on the pool, so their passes are counted up front
+void pf_stats_solves(PfWorld *w) {
+    for (int island = 0; island < w->island_num; island++) {
+        if (!pf_world_island_at_rest(w, island)) {
+            const int contact_num = w->island_start[island + 1] - w->island_start[island];
+            w->stats.solver_iterations += w->iterations;
+            w->stats.contact_solves += w->iterations * contact_num;
+        }
+    }
+}
+#endif
+
+void pf_world_solve_island_objects(void *arg, int island) {
+    PfWorld *w = arg;
+    const int from = w->island_start[island];
+    const int to = w->island_start[island + 1];
+    if (pf_world_island_at_rest(w, island)) {
+        return;
+    }
+    PF_TRACE_BEGIN();
+    for (int k = from; k < to; k++) {
+        PfContact *c = &w->contacts[w->island_contacts[k]];
+        PfBody *a = &w->bodies[c->a_key];
+        PfBody *b = &w->bodies[c->b_key];
+        if (pf_world_solves_contact(a, b)) {
+            pf_warm_start(c, a, b);
+        }
+    }
+    for (int it = 0; it < w->iterations; it++) {
+        for (int k = from; k < to; k++) {
+            PfContact *c = &w->contacts[w->island_contacts[k]];
+            const PfManifold *m = &c->manifold;
+            PfBody *a = &w->bodies[c->a_key];
+            PfBody *b = &w->bodies[c->b_key];
+            if (!pf_world_solves_contact(a, b)) {
+                continue;
+            }
+            if (pf_pushes_objects(a) && pf_pushes_objects(b)) {
+                // bounce off other dynamic bodies
+                a->ex.impulse = subv2f(a->ex.impulse, mulv2nf(m->normal, m->penetration / w->iterations));
+                b->ex.impulse = addv2f(b->ex.impulse, mulv2nf(m->normal, m->penetration / w->iterations));
+                // don't let bodies 'pop-up' if they're on a platform (which might be moving)
+                a->ex.impulse.y = 0;
+                b->ex.impulse.y = 0;
+            }
+            pf_apply_contact(c, a, b);
+        }
+    }
+    PF_TRACE_END(w, "island objects");
+}
+
+void pf_world_solve_objects(PfWorld *w) {
+    pf_world_recall_impulses(w);
+    pf_world_build_islands(w);
+    PF_STATS_SOLVES(w);
+    pf_pool_run(&w->pool, pf_world_solve_island_objects, w, w->island_num);
+    // Impacts are not carried over, they would push bodies apart again next step
+    w->cache_num = 0;
+    for (int i = 0; i < w->contact_num; i++) {
+        if (w->contacts[i].normal_impulse > 0 && w->contacts[i].bounce == 0) {
+            w->cache[w->cache_num++] = w->contacts[i];
+        }
+    }
+    pf_world_clear_stale(w);
+}
+
+void pf_world_solve_island_platforms(void *arg, int island) {
+    PfWorld *w = arg;
+    if (pf_world_island_at_rest(w, island)) {
+        return;
+    }
+    PF_TRACE_BEGIN();
+    for (int it = 0; it < w->iterations; it++) {
+        for (int k = w->island_start[island]; k < w->island_start[island + 1]; k++) {
+            const PfContact *c = &w->contacts[w->island_contacts[k]];
+            const PfManifold *m = &c->manifold;
+            PfBody *a = &w->bodies[c->a_key];
+            PfBody *b = &w->bodies[c->b_key];
+            if (!pf_world_solves_contact(a, b)) {
+                // Resting bodies overlap neighbouring platforms by the slop
+                const float push = fmaxf(0, m->penetration - PF_SLOP) / w->iterations;
+                if (b->mode == PF_MODE_STATIC) {
+                    a->ex.impulse = subv2f(a->ex.impulse, mulv2nf(m->normal, push));
+                }
+                if (a->mode == PF_MODE_STATIC) {
+                    b->ex.impulse = addv2f(b->ex.impulse, mulv2nf(m->normal, push));
+                }
+            }
+        }
+    }
+    PF_TRACE_END(w, "island platforms");
+}
+
+void pf_world_solve_platforms(PfWorld *w) {
+    pf_world_build_islands(w);
+    PF_STATS_SOLVES(w);
+    pf_pool_run(&w->pool, pf_world_solve_island_platforms, w, w->island_num);
+}
+
+void pf_world_correct_positions(PfWorld *w) {
+    for (int i = 0; i < w->contact_num; i++) {
+        const PfContact *c = &w->contacts[i];
+        PfBody *a = &w->bodies[c->a_key];
+        PfBody *b = &w->bodies[c->b_key];
+        if (a->mode == PF_MODE_STATIC || b->mode == PF_MODE_STATIC) {
+            pf_pos_correction(&c->manifold, a, b);
+        }
+    }
+}
+
+// Sleeping bodies wake when pushed or when an awake body touches them
+// Whether a stood on a body that has been destroyed since
+bool pf_world_lost_parent(const PfWorld *w, const PfBody *a) {
+    return !pf_handle_none(a->group.object.parent) && !pf_world_get(w, a->group.object.parent);
+}
+
+// Sleepers pushed, or left standing on nothing, move again
+void pf_world_wake_pushed(PfWorld *w) {
+    for (int i = 0; i < w->body_num; i++) {
+        PfBody *a = &w->bodies[i];
+        if (a->asleep && (!pf_body_at_rest(a) || pf_world_lost_parent(w, a))) {
+            pf_body_wake(a);
+        }
+    }
+}
+
+void pf_world_wake_touched(PfWorld *w) {
+    for (int i = 0; i < w->contact_num; i++) {
+        PfBody *a = &w->bodies[w->contacts[i].a_key];
+        PfBody *b = &w->bodies[w->contacts[i].b_key];
+        if (a->asleep && b->mode == PF_MODE_DYNAMIC && !b->asleep) {
+            pf_body_wake(a);
+        }
+        if (b->asleep && a->mode == PF_MODE_DYNAMIC && !a->asleep) {
+            pf_body_wake(b);
+        }
+    }
+}
+
+void pf_world_update_sleep(PfWorld *w) {
+    for (int i = 0; i < w->body_num; i++) {
+        PfBody *a = &w->bodies[i];
+        if (a->mode != PF_MODE_DYNAMIC || a->asleep) {
+            continue;
+        }
+        if (w->sleep_steps > 0 && pf_body_at_rest(a) && nearzerof(a->dpos.x) && nearzerof(a->dpos.y)) {
+            a->still++;
+            a->asleep = a->still >= w->sleep_steps;
+        } else {
+            a->still = 0;
+        }
+    }
+}
+
+void pf_world_remember_positions(PfWorld *w) {
+    for (int i = 0; i < w->body_num; i++) {
+        w->bodies[i].prev_pos = w->bodies[i].pos;
+    }
+}
+
+#if defined(PF_STATS) || defined(PF_TRACE)
+const char *pf_phase_names[PF_PHASE_NUM] = {
+    "relations", "platforms", "contacts", "solve", "correct",
+};
+
+void pf_world_phase_start(PfWorld *w) {
+    w->step_start_us = pf_now_us();
+    w->phase_start_us = w->step_start_us;
+}
+
+void pf_world_phase_end(PfWorld *w, PfPhase phase) {
+    const double now = pf_now_us();
+    PF_STATS_ADD(w, phase_us[phase], now - w->phase_start_us);
+#ifdef PF_TRACE
+    pf_trace_push(&w->trace, pf_phase_names[phase], w->phase_start_us, now);
+#endif
+    w->phase_start_us = now;
+}
+#endif
+
+// Broadphase pair changes of the whole step, for the broadphases that keep them
+void pf_world_report_pairs(PfWorld *w) {
+    if (w->broadphase == PF_BROADPHASE_SAP) {
+        pf_sap_report(&w->sap);
+    }
+}
+
+void pf_world_step(PfWorld *w, float dt) {
+    PF_PHASE_START(w);
+    pf_world_remember_positions(w);
+    pf_world_wake_pushed(w);
+    // Define objects and platforms relationships
+    pf_world_relations(w);
+    PF_PHASE_END(w, PF_PHASE_RELATIONS);
+    // Move platforms (no collisions)
+    pf_world_move_platforms(w, dt);
+    // Assign objects' positions if on platform
+    pf_world_carry_objects(w);
+    PF_PHASE_END(w, PF_PHASE_PLATFORMS);
+    // Step objects as normally
+    w->contact_num = 0;
+    pf_world_generate_contacts(w);
+    PF_STATS_ADD(w, manifolds, w->contact_num);
+    pf_world_wake_touched(w);
+    PF_PHASE_END(w, PF_PHASE_CONTACTS);
+    pf_world_integrate(w, dt);
+    pf_world_sweep_bodies(w);
+    pf_world_solve_objects(w);
+    PF_PHASE_END(w, PF_PHASE_SOLVE);
+    // Contacts again after objects moved
+    pf_world_relations(w);
+    PF_PHASE_END(w, PF_PHASE_RELATIONS);
+    w->contact_num = 0;
+    pf_world_generate_contacts(w);
+    PF_STATS_ADD(w, manifolds, w->contact_num);
+    pf_world_wake_touched(w);
+    pf_world_report_pairs(w);
+    PF_PHASE_END(w, PF_PHASE_CONTACTS);
+    pf_world_solve_platforms(w);
+    PF_PHASE_END(w, PF_PHASE_SOLVE);
+    pf_world_correct_positions(w);
+    pf_world_update_sleep(w);
+    w->contact_num = 0;
+    PF_PHASE_END(w, PF_PHASE_CORRECT);
+    PF_STATS_ADD(w, steps, 1);
+    PF_TRACE_STEP(w);
+}
+
+// Runs whole steps of w->dt for the elapsed real time and returns how many.
+// Past max_steps the rest is dropped, so a slow frame slows the world down
+// instead of making the next frame slower still.
+int pf_world_advance(PfWorld *w, float elapsed) {
+    w->accumulator += elapsed;
+    int steps = 0;
+    while (w->accumulator >= w->dt) {
+        if (w->max_steps > 0 && steps == w->max_steps) {
+            w->accumulator = fmodf(w->accumulator, w->dt);
+            break;
+        }
+        if (w->before_step) {
+            w->before_step(w->step_arg);
+        }
+        pf_world_step(w, w->dt);
+        w->accumulator -= w->dt;
+        steps++;
+    }
+    return steps;
+}
+
+// How far between the last two steps the leftover time reaches, 0 to 1
+float pf_world_alpha(const PfWorld *w) {
+    return clampf(0, 1, w->accumulator / w->dt);
+}
+
+v2f pf_body_lerp_pos(const PfBody *a, float alpha) {
+    return lerp(a->prev_pos, a->pos, alpha);
+}
+
+void pf_checksum_bytes(unsigned *h, const void *data, size_t size) {
+    const unsigned char *p = data;
+    for (size_t k = 0; k < size; k++) {
+        *h = (*h ^ p[k]) * 16777619u;
+    }
+}
+
+// Key of the body a stands on, -1 if none
+int pf_body_parent(const PfWorld *w, const PfBody *a) {
+    return a->mode == PF_MODE_DYNAMIC ? pf_world_handle_key(w, a->group.object.parent) : -1;
+}
+
+// FNV-1a over the state a step reads, peers in lockstep compare it to find desyncs
+unsigned pf_world_checksum(const PfWorld *w) {
+    unsigned h = 2166136261u;
+    for (int i = 0; i < w->body_num; i++) {
+        const PfBody *a = &w->bodies[i];
+        const float state[9] = {
+            a->pos.x, a->pos.y, a->dpos.x, a->dpos.y,
+            a->in.impulse.x, a->in.impulse.y,
+            a->ex.impulse.x, a->ex.impulse.y,
+            a->gravity.vel,
+        };
+        const int parent = pf_body_parent(w, a);
+        pf_checksum_bytes(&h, state, sizeof(state));
+        pf_checksum_bytes(&h, &parent, sizeof(parent));
+        pf_checksum_bytes(&h, &a->asleep, sizeof(a->asleep));
+        pf_checksum_bytes(&h, &a->still, sizeof(a->still));
+    }
+    return h;
+}
+
+void pf_world_reset_stats(PfWorld *w) {
+    memset(&w->stats, 0, sizeof(w->stats));
+}
+
+// Keeps the last cap events from now on, 0 stops tracing
+bool pf_world_trace(PfWorld *w, int cap) {
+    free(w->trace.events);
+    w->trace = (PfTrace) { .events = NULL, .cap = 0, .next = 0 };
+    if (cap <= 0) {
+        return true;
+    }
+    w->trace.events = malloc(sizeof(PfTraceEvent) * cap);
+    if (!w->trace.events) {
+        return false;
+    }
+    w->trace.cap = cap;
+    return true;
+}
+
+#define PF_TRACE_THREADS 64
+
+// Small ids for threads in order of appearance, the ones past PF_TRACE_THREADS share the last
+int pf_trace_thread(unsigned long *threads, int *thread_num, unsigned long thread) {
+    for (int i = 0; i < *thread_num; i++) {
+        if (threads[i] == thread) {
+            return i;
+        }
+    }
+    if (*thread_num == PF_TRACE_THREADS) {
+        return PF_TRACE_THREADS;
+    }
+    threads[*thread_num] = thread;
+    return (*thread_num)++;
+}
+
+// Writes the recorded events oldest first as Chrome trace JSON, which
+// chrome://tracing and Perfetto open. Call it between steps.
+bool pf_world_dump_trace(const PfWorld *w, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    const PfTrace *t = &w->trace;
+    const unsigned num = t->next < (unsigned)t->cap ? t->next : (unsigned)t->cap;
+    unsigned long threads[PF_TRACE_THREADS];
+    int thread_num = 0;
+    bool ok = fputs("{\"traceEvents\":[\n", f) >= 0;
+    for (unsigned i = 0; i < num && ok; i++) {
+        const PfTraceEvent *e = &t->events[(t->next - num + i) % t->cap];
+        ok = fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}\n",
+            i > 0 ? "," : "",
+            e->name,
+            pf_trace_thread(threads, &thread_num, e->thread),
+            e->begin_us,
+            e->end_us - e->begin_us) > 0;
+    }
+    ok = ok && fputs("]}\n", f) >= 0;
+    return fclose(f) == 0 && ok;
+}
+
+bool pf_snapshot_init(PfSnapshot *s, int body_cap) {
+    s->bodies = malloc(sizeof(PfBody) * body_cap);
+    s->handle_key = malloc(sizeof(int) * (body_cap + 1));
+    s->handle_generation = malloc(sizeof(int) * (body_cap + 1));
+    s->free_handles = malloc(sizeof(int) * body_cap);
+    s->cache = malloc(sizeof(PfContact) * body_cap * 2);
+    s->body_num = 0;
+    s->body_cap = body_cap;
+    s->free_handle_num = 0;
+    s->handle_num = 1;
+    s->statics_version = 0;
+    s->cache_num = 0;
+    s->accumulator = 0;
+    if (!s->bodies || !s->handle_key || !s->handle_generation || !s->free_handles || !s->cache) {
+        pf_snapshot_free(s);
+        return false;
+    }
+    return true;
+}
+
+void pf_snapshot_free(PfSnapshot *s) {
+    free(s->bodies);
+    free(s->handle_key);
+    free(s->handle_generation);
+    free(s->free_handles);
+    free(s->cache);
+    s->bodies = NULL;
+    s->handle_key = NULL;
+    s->handle_generation = NULL;
+    s->free_handles = NULL;
+    s->cache = NULL;
+    s->body_num = 0;
+    s->body_cap = 0;
+    s->free_handle_num = 0;
+    s->handle_num = 1;
+    s->cache_num = 0;
+}
+
+// Copies the live bodies, their handles and the contact cache, false if s is too small
+bool pf_world_snapshot(const PfWorld *w, PfSnapshot *s) {
+    if (w->body_num > s->body_cap || w->handle_num > s->body_cap + 1) {
+        return false;
+    }
+    memcpy(s->bodies, w->bodies, sizeof(PfBody) * w->body_num);
+    memcpy(s->handle_key, w->handle_key, sizeof(int) * w->handle_num);
+    memcpy(s->handle_generation, w->handle_generation, sizeof(int) * w->handle_num);
+    memcpy(s->free_handles, w->free_handles, sizeof(int) * w->free_handle_num);
+    s->cache_num = 0;
+    for (int i = 0; i < w->cache_num; i++) {
+        if (pf_world_cached(w, &w->cache[i])) {
+            s->cache[s->cache_num++] = w->cache[i];
+        }
+    }
+    s->body_num = w->body_num;
+    s->handle_num = w->handle_num;
+    s->free_handle_num = w->free_handle_num;
+    s->statics_version = w->statics_version;
+    s->accumulator = w->accumulator;
+    return true;
+}
+
+bool pf_world_static_moved(const PfWorld *w, int key) {
+    const PfAabb box = pf_body_to_aabb(&w->bodies[key]);
+    const PfAabb *leaf = &w->statics.nodes[w->statics.leaves[key]].aabb;
+    return
+        box.min.x != leaf->min.x || box.min.y != leaf->min.y ||
+        box.max.x != leaf->max.x || box.max.y != leaf->max.y;
+}
+
+// Whether a turning into b leaves it asleep somewhere else. Sleeping bodies'
+// proxies aren't updated, so the old one has to go.
+bool pf_body_moved_asleep(const PfBody *a, const PfBody *b) {
+    if (!b->asleep) {
+        return false;
+    }
+    const PfAabb a_box = pf_body_to_aabb(a);
+    const PfAabb b_box = pf_body_to_aabb(b);
+    return !eqv2f(a_box.min, b_box.min) || !eqv2f(a_box.max, b_box.max);
+}
+
+// Puts w back as it was at the snapshot, bodies created since are dropped and
+// bodies destroyed since come back under their old handles
+void pf_world_restore(PfWorld *w, const PfSnapshot *s) {
+    for (int i = 0; i < w->body_num || i < s->body_num; i++) {
+        pf_store_rest(&w->store, i);
+    }
+    for (int i = 0; i < w->body_num; i++) {
+        // Keys holding another body than at the snapshot, or one sleeping
+        // elsewhere, get fresh proxies
+        if (i >= s->body_num || !pf_handle_eq(w->bodies[i].handle, s->bodies[i].handle) ||
+            pf_body_moved_asleep(&w->bodies[i], &s->bodies[i])) {
+            pf_world_remove_proxy(w, i);
+        }
+    }
+    memcpy(w->bodies, s->bodies, sizeof(PfBody) * s->body_num);
+    memcpy(w->handle_key, s->handle_key, sizeof(int) * s->handle_num);
+    memcpy(w->handle_generation, s->handle_generation, sizeof(int) * s->handle_num);
+    memcpy(w->free_handles, s->free_handles, sizeof(int) * s->free_handle_num);
+    memcpy(w->cache, s->cache, sizeof(PfContact) * s->cache_num);
+    w->body_num = s->body_num;
+    w->handle_num = s->handle_num;
+    w->free_handle_num = s->free_handle_num;
+    w->cache_num = s->cache_num;
+    pf_world_clear_stale(w);
+    w->accumulator = s->accumulator;
+    w->contact_num = 0;
+    // The tree changed members since, build it again for the restored bodies
+    if (w->statics_version != s->statics_version) {
+        pf_world_build_static_tree(w);
+        w->statics_version = s->statics_version;
+        return;
+    }
+    for (int i = 0; i < w->body_num; i++) {
+        // Moving platforms refit the tree as they go
+        if (pf_world_in_static_tree(w, i) && pf_world_static_moved(w, i)) {
+            pf_world_refit_static(w, i);
+        }
+    }
+}
+
+#define PF_LEVEL_VERSION 3
+
+// Level files start with this, then hold body_num bodies, node_num static
+// tree nodes and the tree leaf of each body. Everything is in the writer's
+// memory layout so loading is copying.
+typedef struct {
+    char magic[4];
+    int version;
+    int body_size;          // Levels load only into builds with the same layout
+    int node_size;
+    int body_num;
+    int node_num;
+    int root;               // -1 if the level has no static tree
+    int padding;
+} PfLevelHeader;
+
+// Writes the bodies of w, precomputed shapes and static tree included
+bool pf_world_save_level(const PfWorld *w, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    const bool tree = w->statics.root != -1;
+    const PfLevelHeader header = {
+        .magic = {'P', 'F', 'L', 'V'},
+        .version = PF_LEVEL_VERSION,
+        .body_size = sizeof(PfBody),
+        .node_size = sizeof(PfBvhNode),
+        .body_num = w->body_num,
+        .node_num = tree ? w->statics.node_num : 0,
+        .root = tree ? w->statics.root : -1,
+        .padding = 0,
+    };
+    bool ok =
+        fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(w->bodies, sizeof(PfBody), w->body_num, f) == (size_t)w->body_num;
+    if (ok && tree) {
+        ok =
+            fwrite(w->statics.nodes, sizeof(PfBvhNode), w->statics.node_num, f) == (size_t)w->statics.node_num &&
+            fwrite(w->statics.leaves, sizeof(int), w->body_num, f) == (size_t)w->body_num;
+    }
+    return fclose(f) == 0 && ok;
+}
+
+// Takes the handles saved bodies carry, the slots between them become free
+bool pf_world_read_handles(PfWorld *w, const PfBody *bodies, int body_num) {
+    int handle_num = 1;
+    for (int i = 0; i < body_num; i++) {
+        const PfHandle h = bodies[i].handle;
+        if (h.index <= 0 || h.index > w->body_cap) {
+            return false;
+        }
+        handle_num = h.index >= handle_num ? h.index + 1 : handle_num;
+    }
+    for (int i = 0; i < handle_num; i++) {
+        w->handle_key[i] = -1;
+        w->handle_generation[i] = 0;
+    }
+    for (int i = 0; i < body_num; i++) {
+        const PfHandle h = bodies[i].handle;
+        if (w->handle_key[h.index] != -1) {
+            w->handle_num = 1;
+            return false;
+        }
+        w->handle_key[h.index] = i;
+        w->handle_generation[h.index] = h.generation;
+    }
+    w->handle_num = handle_num;
+    w->free_handle_num = 0;
+    for (int i = handle_num - 1; i > 0; i--) {
+        if (w->handle_key[i] == -1) {
+            w->free_handles[w->free_handle_num++] = i;
+        }
+    }
+    return true;
+}
+
+// Shapes every later switch on must have a known tag and corner
+bool pf_level_shapes_valid(const PfBody *bodies, int body_num) {
+    for (int i = 0; i < body_num; i++) {
+        const PfShape *s = &bodies[i].shape;
+        if ((unsigned)s->tag > PF_SHAPE_TRI) {
+            return false;
+        }
+        if (s->tag == PF_SHAPE_TRI && (unsigned)s->tri.hypotenuse > PF_CORNER_DR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every index in range, children pointing back at their parent and leaves
+// matching their body, so walks from the root can neither leave the nodes
+// nor loop
+bool pf_level_tree_valid(const PfBvh *t, int body_num) {
+    if (t->root < 0 || t->root >= t->node_num || t->nodes[t->root].parent != -1) {
+        return false;
+    }
+    for (int i = 0; i < t->node_num; i++) {
+        const PfBvhNode *n = &t->nodes[i];
+        if (n->parent < -1 || n->parent >= t->node_num || (n->parent == -1) != (i == t->root)) {
+            return false;
+        }
+        if (n->key == -1) {
+            if (n->left < 0 || n->left >= t->node_num || n->right < 0 || n->right >= t->node_num ||
+                n->left == n->right ||
+                t->nodes[n->left].parent != i || t->nodes[n->right].parent != i) {
+                return false;
+            }
+        } else if (n->key < 0 || n->key >= body_num || n->left != -1 || n->right != -1 || t->leaves[n->key] != i) {
+            return false;
+        }
+    }
+    for (int i = 0; i < body_num; i++) {
+        const int leaf = t->leaves[i];
+        if (leaf != -1 && (leaf < 0 || leaf >= t->node_num || t->nodes[leaf].key != i)) {
+            return false;
+        }
+    }
+    // Walks the whole tree the way queries do, which never need more room
+    int stack[PF_BVH_STACK];
+    int top = 0;
+    stack[top++] = t->root;
+    while (top > 0) {
+        const PfBvhNode *n = &t->nodes[stack[--top]];
+        if (n->key == -1) {
+            if (top + 2 > PF_BVH_STACK) {
+                return false;
+            }
+            stack[top++] = n->right;
+            stack[top++] = n->left;
+        }
+    }
+    return true;
+}
+
+bool pf_world_read_level(PfWorld *w, const unsigned char *data, size_t size) {
+    PfLevelHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, "PFLV", 4) != 0 ||
+        header.version != PF_LEVEL_VERSION ||
+        header.body_size != sizeof(PfBody) ||
+        header.node_size != sizeof(PfBvhNode) ||
+        header.body_num < 0 || header.body_num > w->body_cap ||
+        header.node_num < 0 || header.node_num > 2 * header.body_num ||
+        (header.root == -1) != (header.node_num == 0)) {
+        return false;
+    }
+    const size_t bodies = sizeof(header);
+    const size_t nodes = bodies + sizeof(PfBody) * header.body_num;
+    const size_t leaves = nodes + sizeof(PfBvhNode) * header.node_num;
+    const size_t end = leaves + (header.node_num > 0 ? sizeof(int) * header.body_num : 0);
+    if (size != end || !pf_level_shapes_valid((const PfBody*)(data + bodies), header.body_num)) {
+        return false;
+    }
+    if (header.node_num > 0) {
+        PfBvh t = {
+            .nodes = malloc(sizeof(PfBvhNode) * header.node_num),
+            .node_num = header.node_num,
+            .root = header.root,
+            .leaves = malloc(sizeof(int) * w->body_cap),
+            .key_cap = w->body_cap,
+        };
+        if (!t.nodes || !t.leaves) {
+            pf_bvh_free(&t);
+            return false;
+        }
+        memcpy(t.nodes, data + nodes, sizeof(PfBvhNode) * header.node_num);
+        memcpy(t.leaves, data + leaves, sizeof(int) * header.body_num);
+        for (int i = header.body_num; i < w->body_cap; i++) {
+            t.leaves[i] = -1;
+        }
+        if (!pf_level_tree_valid(&t, header.body_num)) {
+            pf_bvh_free(&t);
+            return false;
+        }
+        pf_bvh_free(&w->statics);
+        w->statics = t;
+        w->statics_version++;
+    }
+    if (!pf_world_read_handles(w, (const PfBody*)(data + bodies), header.body_num)) {
+        pf_bvh_free(&w->statics);
+        return false;
+    }
+    memcpy(w->bodies, data + bodies, sizeof(PfBody) * header.body_num);
+    for (int i = 0; i < header.body_num; i++) {
+        pf_store_rest(&w->store, i);
+    }
+    w->body_num = header.body_num;
+    return true;
+}
+
+// Reads a level file into an empty world and copies its bodies and static
+// tree in once they check out. Shapes, links and the tree come out as saved,
+// nothing is rebuilt.
+bool pf_world_copy_level(PfWorld *w, const char *path) {
+    if (w->body_num != 0) {
+        return false;
+    }
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    long size = -1;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        size = ftell(f);
+    }
+    unsigned char *data = size > 0 && fseek(f, 0, SEEK_SET) == 0 ? malloc(size) : NULL;
+    const bool read = data && fread(data, 1, size, f) == (size_t)size;
+    fclose(f);
+    const bool ok = read && pf_world_read_level(w, data, size);
+    free(data);
+    return ok;
+}
+
+// Fields of one body in an encoded frame, set in its mask when they changed
+enum {
+    PF_DELTA_POS = 1,
+    PF_DELTA_DPOS = 2,
+    PF_DELTA_IN = 4,
+    PF_DELTA_EX = 8,
+    PF_DELTA_GRAVITY = 16,
+    PF_DELTA_PARENT = 32,
+    PF_DELTA_ASLEEP = 64,
+};
+
+// Quantized replicated state, in the order frames write it
+typedef struct {
+    int q[9];               // pos, dpos, in and ex impulse, gravity vel
+    int parent;
+    bool asleep;
+} PfQuantized;
+
+int pf_quantize(float v) {
+    return (int)floorf(clampf(-PF_QUANTUM_MAX, PF_QUANTUM_MAX, v * PF_QUANTUM) + 0.5f);
+}
+
+float pf_dequantize(int q) {
+    return q / PF_QUANTUM;
+}
+
+PfQuantized pf_body_quantize(const PfBody *a, int parent) {
+    const float v[9] = {
+        a->pos.x, a->pos.y, a->dpos.x, a->dpos.y,
+        a->in.impulse.x, a->in.impulse.y,
+        a->ex.impulse.x, a->ex.impulse.y,
+        a->gravity.vel,
+    };
+    PfQuantized q = { .parent = parent, .asleep = a->asleep };
+    for (int k = 0; k < 9; k++) {
+        q.q[k] = pf_quantize(v[k]);
+    }
+    return q;
+}
+
+void pf_body_dequantize(const PfWorld *w, PfBody *a, const PfQuantized *q) {
+    a->pos = _v2f(pf_dequantize(q->q[0]), pf_dequantize(q->q[1]));
+    a->dpos = _v2f(pf_dequantize(q->q[2]), pf_dequantize(q->q[3]));
+    a->in.impulse = _v2f(pf_dequantize(q->q[4]), pf_dequantize(q->q[5]));
+    a->ex.impulse = _v2f(pf_dequantize(q->q[6]), pf_dequantize(q->q[7]));
+    a->gravity.vel = pf_dequantize(q->q[8]);
+    if (a->mode == PF_MODE_DYNAMIC) {
+        a->group.object.parent = q->parent == -1 ? PF_NO_HANDLE : w->bodies[q->parent].handle;
+    }
+    a->asleep = q->asleep;
+}
+
+void pf_world_dequantize(PfWorld *w, int i, const PfQuantized *q) {
+    const PfBody before = w->bodies[i];
+    pf_body_dequantize(w, &w->bodies[i], q);
+    if (pf_body_moved_asleep(&before, &w->bodies[i])) {
+        pf_world_remove_proxy(w, i);
+    }
+}
+
+PfQuantized pf_world_quantize(const PfWorld *w, int i) {
+    return pf_body_quantize(&w->bodies[i], pf_body_parent(w, &w->bodies[i]));
+}
+
+// Key i of the baseline, zeros for bodies it doesn't have
+PfQuantized pf_base_quantize(const PfSnapshot *base, int i) {
+    if (!base || i >= base->body_num) {
+        return (PfQuantized) { .parent = -1, .asleep = false };
+    }
+    const PfBody *a = &base->bodies[i];
+    const int parent = a->mode == PF_MODE_DYNAMIC
+        ? pf_handle_lookup(base->handle_key, base->handle_generation, base->handle_num, a->group.object.parent)
+        : -1;
+    return pf_body_quantize(a, parent);
+}
+
+bool pf_write_varint(unsigned char *out, size_t cap, size_t *at, unsigned v) {
+    do {
+        if (*at == cap) {
+            return false;
+        }
+        out[(*at)++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+        v >>= 7;
+    } while (v);
+    return true;
+}
+
+bool pf_read_varint(const unsigned char *in, size_t size, size_t *at, unsigned *v) {
+    *v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (*at == size) {
+            return false;
+        }
+        const unsigned char byte = in[(*at)++];
+        *v |= (unsigned)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Small deltas of either sign take few bytes. Deltas are two's complement
+// in unsigned, so taking and adding them wraps instead of overflowing.
+unsigned pf_zigzag(unsigned d) {
+    return (d << 1) ^ (0u - (d >> 31));
+}
+
+unsigned pf_unzigzag(unsigned v) {
+    return (v >> 1) ^ (0u - (v & 1));
+}
+
+// Mask bit of quantized value k
+unsigned char pf_delta_field(int k) {
+    return k < 8 ? 1 << (k / 2) : PF_DELTA_GRAVITY;
+}
+
+unsigned char pf_delta_mask(const PfQuantized *q, const PfQuantized *b) {
+    unsigned char mask = 0;
+    for (int k = 0; k < 9; k++) {
+        if (q->q[k] != b->q[k]) {
+            mask |= pf_delta_field(k);
+        }
+    }
+    mask |= q->parent != b->parent ? PF_DELTA_PARENT : 0;
+    mask |= q->asleep != b->asleep ? PF_DELTA_ASLEEP : 0;
+    return mask;
+}
+
+// Writes the replicated state of w as changes from base, or from zero if base
+// is NULL. Returns the bytes written, 0 if out is too small. Both ends must
+// hold the same baseline, snapshots of decoded worlds match the sender's.
+size_t pf_world_encode(const PfWorld *w, const PfSnapshot *base, unsigned char *out, size_t cap) {
+    size_t at = 0;
+    if (!pf_write_varint(out, cap, &at, w->body_num)) {
+        return 0;
+    }
+    // Changed bodies are written as the gap from the last one, a gap reaching
+    // body_num ends the frame
+    int last = -1;
+    for (int i = 0; i < w->body_num; i++) {
+        const PfQuantized q = pf_world_quantize(w, i);
+        const PfQuantized b = pf_base_quantize(base, i);
+        const unsigned char mask = pf_delta_mask(&q, &b);
+        if (!mask) {
+            continue;
+        }
+        if (!pf_write_varint(out, cap, &at, i - last - 1) || at == cap) {
+            return 0;
+        }
+        last = i;
+        out[at++] = mask;
+        for (int k = 0; k < 9; k++) {
+            if ((mask & pf_delta_field(k)) && !pf_write_varint(out, cap, &at, pf_zigzag((unsigned)q.q[k] - (unsigned)b.q[k]))) {
+                return 0;
+            }
+        }
+        if ((mask & PF_DELTA_PARENT) && !pf_write_varint(out, cap, &at, q.parent + 1)) {
+            return 0;
+        }
+    }
+    return pf_write_varint(out, cap, &at, w->body_num - last - 1) ? at : 0;
+}
+
+// Applies a frame from pf_world_encode to w, which must already hold its bodies.
+// Every replicated field is set, unchanged ones from the baseline.
+bool pf_world_decode(PfWorld *w, const PfSnapshot *base, const unsigned char *in, size_t size) {
+    size_t at = 0;
+    unsigned body_num;
+    if (!pf_read_varint(in, size, &at, &body_num) || body_num > (unsigned)w->body_num) {
+        return false;
+    }
+    unsigned next = 0;
+    while (true) {
+        unsigned gap;
+        if (!pf_read_varint(in, size, &at, &gap) || gap > body_num - next) {
+            return false;
+        }
+        // Bodies skipped over are as the baseline has them
+        for (unsigned i = next; i < next + gap; i++) {
+            const PfQuantized b = pf_base_quantize(base, i);
+            pf_world_dequantize(w, i, &b);
+        }
+        next += gap;
+        if (next == body_num) {
+            return at == size;
+        }
+        if (at == size) {
+            return false;
+        }
+        const unsigned char mask = in[at++];
+        PfQuantized q = pf_base_quantize(base, next);
+        for (int k = 0; k < 9; k++) {
+            unsigned v;
+            if (mask & pf_delta_field(k)) {
+                if (!pf_read_varint(in, size, &at, &v)) {
+                    return false;
+                }
+                q.q[k] = (int)((unsigned)q.q[k] + pf_unzigzag(v));
+            }
+        }
+        if (mask & PF_DELTA_PARENT) {
+            unsigned v;
+            if (!pf_read_varint(in, size, &at, &v) || v > body_num) {
+                return false;
+            }
+            q.parent = (int)v - 1;
+        }
+        q.asleep = (mask & PF_DELTA_ASLEEP) ? !q.asleep : q.asleep;
+        pf_world_dequantize(w, next, &q);
+        next++;
+    }
+}